@@ -116,6 +116,7 @@ get_ram_phyaddr_from_dt()
  #	};
  local dt_ram=0
  [[ ! -d /proc/device-tree ]] && return # no DT, np
+ [ "${PROC_ROOT}" != "/proc" ] && return # --render: not this machine's DT
  # Get it from the token after the @ symbol; easier...
  dt_ram=$(dtc -I fs /proc/device-tree/ 2>/dev/null |grep -A3 "memory@"|grep "reg *= *<")
  # fetch only the first hex number (following the '<')
@@ -140,7 +141,11 @@ local start_pa end_pa mapname
 local start_kva end_kva
 
 ###--- This appears to be the ONE place where we still require sudo ! ---###
-sudo grep -w "Kernel" /proc/iomem > ${TMPF}
+if [ "${PROC_ROOT}" = "/proc" ] ; then
+   sudo grep -w "Kernel" /proc/iomem > ${TMPF}
+else  # --render: the snapshot's
+   grep -w "Kernel" ${PROC_ROOT}/iomem > ${TMPF} 2>/dev/null || true
+fi
 
 #--- loop over the kernel image recs
  IFS=$'\n'
@@ -359,6 +364,36 @@ setup_noncanonical_sparse_region()
   fi
 }
 
+# kernel_occupancy_annotate()
+# With the procmap LKM loaded (and root), annotate the vmalloc, module and
+# fixmap regions with their live occupancy, as computed in-kernel by the LKM
+# (see it's kseg_occupancy debugfs file): the space used (and % of the
+# region), the # of areas, the largest free gap and an occupancy strip of the
+# region (lower kva on the left), one of
+#  _.:-=+*#%@
+# per sixteenth of it, from unused ('_') to fully used ('@'). These are
+# written as annotations (see graphit()) into ${KANNOTFILE}.
+kernel_occupancy_annotate()
+{
+local occ=${DBGFS_LOC}/${KMOD}/${DBGFS_OCC_FILENAME}
+rm -f ${KANNOTFILE}
+[ ${SHOW_KOCCUPANCY} -eq 0 -o "${PROC_ROOT}" != "/proc" ] && return 0
+[ -r ${occ} ] || return 0
+awk -F"${gDELIM}" "${AWK_HEXLIB}"'
+NF >= 7 {
+  key = $1 ; sub(/^0+/, "", key)   # as the kernel segment table has it
+  size = hex2dec($2) - hex2dec($1)
+  printf("%s,used %s (%.2f%%)  areas %d  largest free %s\n", key, hsz($3),
+	 size > 0 ? $3*100/size : 0, $4, hsz($5))
+  n = split($6, h, ":") ; strip = ""
+  for (i = 1; i <= n; i++) {
+    c = substr("_.:-=+*#%@", int(h[i] * 9 / 100 + 0.999999) + 1, 1)
+    strip = strip c c c
+  }
+  printf("%s,occ  [%s]\n", key, strip)
+}' ${occ} > ${KANNOTFILE} 2>/dev/null || rm -f ${KANNOTFILE}
+} # end kernel_occupancy_annotate()
+
 # populate_kernel_segment_mappings()
 populate_kernel_segment_mappings()
 {
@@ -370,7 +405,7 @@ populate_kernel_segment_mappings()
  local i=1
  local REC
  prevseg_start_kva=0
- for REC in $(cat ${KSEGFILE})
+ for REC in $(grep -v "^PAGE_SIZE${gDELIM}\|^TASK_SIZE${gDELIM}" ${KSEGFILE})
  do 
    decho "REC: $REC"
    interpret_kernel_rec ${REC} ${i}
@@ -400,5 +435,6 @@ populate_kernel_segment_mappings()
  show_gkArray 0 > /tmp/${name}/pmk
  sort -t"," -k4 -r /tmp/${name}/pmk > /tmp/${name}/pmkfinal
  ##################
+ kernel_occupancy_annotate
  [ ${DEBUG} -eq 1 ] && cat /tmp/${name}/pmkfinal
 } # end populate_kernel_segment_mappings()
@@ -71,19 +71,19 @@ decho "range: [${start_dec} to ${end_dec}]: total size=${gTotalLen}"
 } # end get_range_info()
 
 #---
-# Userspace array:
-# We require a 6d array: each 'row' will hold these values:
+# Userspace segment table (the 'gArray'):
+# Each 'row' holds these values:
 #
 #          col0     col1      col2       col3   col4    col5
 # row'n' [segname],[size],[start_uva],[end_uva],[mode],[offset]
 #
-# HOWEVER, bash only actually supports 1d array; we thus treat a simple 1d
-# array as an 'n'd (n=6) array! 
-# So we just populate a 1d array like this:
-#  [val1] [val2] [val3] [val4] [val5] [val6] [val7] [val8] [...]
-# but INTERPRET it as 6d like so:
-#  ([val1],[val2],[val3],[val4],[val5],[val6]),([val7],[val8],[val9],val[10],...) [...]
-declare -a gArray
+# Earlier, we populated a bash 1d array (gArray), INTERPRETING it as 6d, by
+# calling interpret_user_rec() once per VMA; with several subprocesses spawned
+# per record, that took minutes on processes with tens of thousands of VMAs.
+# Now, build_user_segtable() builds the very same table - sparse regions and
+# the NULL trap page included - in a single pass over the input and writes it
+# out, already ordered by descending va, as CSV into /tmp/${name}/pmufinal.
+# gRow is the # of (6d) 'cells' in the table, as before.
 gRow=0
 #---
 
@@ -91,227 +91,947 @@ gRow=0
 declare -a gkArray
 gkRow=0
 
-#-----------------------s h o w A r r a y -----------------------------
-# Parameters:
-#   $1 : debug print; if 1, it's just a debug print, if 0 we're writing it's
-#        data to a file in order to process further (sort/etc)
-showArray()
-{
-local i k DIM=6
-
-if [ $1 -eq 1 ] ; then
-  echo
-  decho "gRow = ${gRow}"
-  # gArray ::  [segname],[size],[start_va],[end_va],[mode],[offset]
-  echo "showArray():
-[segname,size,start_uva,end_uva,mode,offset]"
-fi
-
-for ((i=0; i<${gRow}; i+=${DIM}))
-do
-    printf "%s," "${gArray[${i}]}"   # segname
-	let k=i+1
-    printf "%d," "${gArray[${k}]}"     # seg size
-	let k=i+2
-    #--- Nice bugfix here!
-    # On the TI BBB 32-bit, i noticed that the 'heap' would appear at or near
-    # the very top of the user VAS! that's just wrong... Investigating, i found
-    # that its as the /tmp/procmap/pmu file records were'nt being correctly
-    # sorted.. That was as running sort(1) on hex numbers does work *as long as
-    # they're seen as numbers and not strings*. To do that, we have to ensure
-    # that #s - like the start and end UVAs here - are left-padded with 0s!
-    # Then sort works correctly and all's well!
-    # (Interestingly, the %0zx printf format has it work portably for 32 and 64
-    # bit - avoiding the need to explicitly do %08x / %016x for 32/64 bit!)
-    printf "%0zx," "0x${gArray[${k}]}"   # start va
-	let k=i+3
-    printf "%0zx," "0x${gArray[${k}]}"   # end va
-    #---
-	let k=i+4
-    # UNSURE / RELOOK
-    # error here ?? only on console device (no color)
-    # 'environment: line 131: printf: : invalid number' ??
-    printf "%s," "${gArray[${k}]}"     # mode+flag
-	let k=i+5
-    printf "%x\n" "0x${gArray[${k}]}" # file offset
-done
-} # end showArray()
-
 gNumSparse=0
 gTotalSparseSize=0
 gTotalSegSize=0
 
-setup_nulltrap_page()
-{
-  local pgsz_hex=$(printf "%x" ${PAGE_SIZE})
-  append_userspace_mapping "${NULLTRAP_STR}" ${PAGE_SIZE} 0 \
-     ${pgsz_hex} "----" 0
-
-  # RELOOK? Treat the NULL trap page as a sparse region??
-  inc_sparse ${PAGE_SIZE}
-} # end setup_nulltrap_page()
-
-
-#------------- i n t e r p r e t _ u s e r _ r e c ---------------------
-# Interpret record (a CSV 'line' from the input stream) and populate the
-# gArr[] n-dim array.
-# Format:
+#------------- b u i l d _ u s e r _ s e g t a b l e --------------------
+# The userspace 'maps engine'.
+# Reads the input CSV file (one record per VMA, ordered by descending va)
+# exactly once and generates the userspace segment table (see the 'gArray'
+# comment above), writing it to the file passed.
+# Input record format:
 #  start_uva,end_uva,mode/p|s,offset,image_file
 #     ; uva = user virtual address
 # eg.
 #  7f1827411000,7f1827412000,rw-p,00028000,/lib/x86_64-linux-gnu/ld-2.27.so
-# - 7f3390031000,7f3390053000,/lib/x86_64-linux-gnu/libc-2.28.so
-# Parameters:
-#  $1 : the above CSV format string of 5 fields {start_uva,end_uva,mode,off,segname}
-#  $2 : loop index
-# Populate the global 'n-dim' (n=6) array gArray.
+#
+# This does - within one awk(1) process - what the (older) per-record
+# interpret_user_rec(), setup_usparse_top(), setup_nulltrap_page() and
+# total_size_userspc() functions did:
+#  - the userspace sparse region at the very top (high) end of the VAS
+#  - a sparse region wherever the gap between two segments is > 1 page
+#  - the sparse region just above, and the NULL trap page at, the bottom
+#  - the --locate region, if any
+#  - the stats: # and total size of sparse regions, total mapped size
+# The stats are written (as 'name=value' lines, to be sourced) into ${2}.stats
+#
+# As we're working with descending va's, the sparse region (gap) is:
+#  gap = prev_seg_start - this-segment-end ; if > 1 page, it's a sparse region.
 # Arch-independent.
-interpret_user_rec()
+#
+# NOTE- awk numbers are double-precision; that's exact up to 2^53, which
+# comfortably covers any user VA (47 to 52 bits). The [vsyscall] page, being
+# in kernel-space, is only ever compared or (optionally) subtracted from it's
+# own end va, both of which remain exact.
+#
+# Parameters:
+#  $1 : input CSV file (5 fields/record: {start_uva,end_uva,mode,off,segname})
+#  $2 : output file (the segment table, CSV, 6 fields/record)
+build_user_segtable()
 {
-local gap=0
-local start_uva=$(echo "${1}" |cut -d"${gDELIM}" -f1)
-local end_uva=$(echo "${1}" |cut -d"${gDELIM}" -f2)
+local loc_start="" loc_len_bytes=0
+if [ ${LOC_LEN} -ne 0 ]; then
+   loc_start=${LOC_STARTADDR}
+   loc_len_bytes=$((LOC_LEN*1024))
+fi
 
-# Skip comment lines
-echo "${start_uva}" | grep -q "^#" && return
+awk -F"${gDELIM}" -v OFS="${gDELIM}" -v pgsz=${PAGE_SIZE} -v end_uva=${END_UVA} \
+    -v sparse_show=${SPARSE_SHOW} -v show_vsyscall=${SHOW_VSYSCALL_PAGE} \
+    -v sparse_entry="${SPARSE_ENTRY}" -v nulltrap="${NULLTRAP_STR}" \
+    -v loc_entry="${LOCATED_REGION_ENTRY}" -v loc_start="${loc_start}" \
+    -v loc_len=${loc_len_bytes} -v statsfile="${2}.stats" "${AWK_HEXLIB}"'
+function inc_sparse(sz) {
+  if (sparse_show == 1) { nsparse++ ; sparse_total += sz }
+}
+# Emit a row; the start and end va(s) are passed both as numbers and as (normalized)
+# hex strings; when the hex strings are null, they are generated from the numbers.
+# A pending --locate region is emitted just before the first row whose end va
+# is lower, thus retaining the descending va order
+function emit(nm, sz, s, e, sh, eh, mode, off) {
+  if (loc_pending && e < loc_end) {
+     printf("%s,%.0f,%s,%s,...,0\n", loc_entry, loc_len, dec2hex(loc_s), dec2hex(loc_end))
+     loc_pending = 0 ; nrows++
+  }
+  if (sh == "") sh = dec2hex(s)
+  if (eh == "") eh = dec2hex(e)
+  printf("%s,%.0f,%s,%s,%s,%s\n", nm, sz, sh, eh, mode, off)
+  nrows++
+  # Is the region to locate within this mapping?
+  if (loc_len > 0 && !loc_done && loc_s >= s && loc_s < e) {
+     loc_pending = 1 ; loc_done = 1
+  }
+  if (nm != sparse_entry && nm != nulltrap) mapped_total += sz
+}
+BEGIN {
+  end_uva_dec = hex2dec(end_uva)
+  if (loc_len > 0) { loc_s = hex2dec(loc_start) ; loc_end = loc_s + loc_len }
+  prev_start = -1 ; prev_name = ""
+}
+/^#/ { next }
+{
+  start = hex2dec($1) ; end = hex2dec($2)
+  start_hex = $1 ; sub(/^0+/, "", start_hex) ; if (start_hex == "") start_hex = "0"
+  end_hex = $2 ; sub(/^0+/, "", end_hex)
+  mode = $3
+  off = $4 ; sub(/^0+/, "", off) ; if (off == "") off = "0"
+  seg = $5 ; if (seg == "") seg = " [-unnamed-] "
+
+  # The userspace sparse region at the very top (high) end of the VAS:
+  # from the topmost valid uva up to the end uva
+  if (!top_done && end < end_uva_dec) {
+     top_done = 1
+     if (end_uva_dec - end > pgsz) {
+        emit(sparse_entry, end_uva_dec - end, end, end_uva_dec, end_hex, "", "----", 0)
+        inc_sparse(end_uva_dec - end)
+     }
+  }
 
-local mode=$(echo "${1}" |cut -d"${gDELIM}" -f3)
-local offset=$(echo "${1}" |cut -d"${gDELIM}" -f4)
-local segment=$(echo "${1}" |cut -d"${gDELIM}" -f5)
-[ -z "${segment}" ] && segment=" [-unnamed-] "
+  # The [vsyscall] page is in kernel-space; hence, we only show it if
+  # our config requires us to...; default is No
+  if (seg == "[vsyscall]" && show_vsyscall == 0) {
+     prev_start = start ; prev_name = seg
+     next
+  }
 
-# Remove any leading zeroes from the offset
-offset=$(echo ${offset}  |sed 's/^0*//')
-[ -z "${offset}" ] && offset=0
+  if (sparse_show == 1) {
+     if (seg != "[vsyscall]" && prev_start >= 0 && prev_name != "[vsyscall]") {
+        gap = prev_start - end
+        if (gap > pgsz) {
+           emit(sparse_entry, gap, end, prev_start, end_hex, "", "----", 0)
+           inc_sparse(gap)
+        }
+     }
+     prev_start = start
+  }
+  emit(seg, end - start, start, end, start_hex, end_hex, mode, off)
+  prev_name = seg
+}
+END {
+  # Setup the Sparse region just before the NULL trap page
+  if (prev_start - pgsz > pgsz) {
+     emit(sparse_entry, prev_start - pgsz, pgsz, prev_start, "", "", "----", 0)
+     inc_sparse(prev_start - pgsz)
+  }
+  # Setup the NULL trap page: the very last entry
+  # (RELOOK? we treat the NULL trap page as a sparse region)
+  emit(nulltrap, pgsz, 0, pgsz, "", "", "----", 0)
+  inc_sparse(pgsz)
+  if (loc_pending)
+     printf("%s,%.0f,%s,%s,...,0\n", loc_entry, loc_len, dec2hex(loc_s), dec2hex(loc_end))
+
+  printf("gRow=%d\ngNumSparse=%d\ngTotalSparseSize=%.0f\ngTotalSegSize=%.0f\n",
+     nrows*6, nsparse, sparse_total, mapped_total) > statsfile
+}' ${1} > ${2}
+
+source ${2}.stats
+[ ${DEBUG} -eq 0 ] && rm -f ${2}.stats || true
+} # end build_user_segtable()
+
+#------------- p a g e m a p _ l i s t ,  p a g e m a p _ r e a d -------
+# The pagemap reader; used by residency_scan() and wss_scan().
+# pagemap_list() writes the mappings to scan, in va order, as
+#  start_hex pagemap_offset #pages
+# and pagemap_read() reads the pagemap entries of all of them, in one pass:
+# the mappings are coalesced into a few spans - those less than PAGEMAP_MAXGAP
+# bytes of pagemap apart (f.e. the libraries) are read as one, the holes just
+# reading as zeroes - each read with one dd(1), using large (1 MB) reads, into
+# od(1), 64 entries per line; each span is preceded by a '@ pagemap_offset'
+# line. So a handful of processes, whatever the # of mappings.
+# AWK_PAGEMAP is the awk that consumes that (with -v list=<the list>): it
+# walks each line's entries mapping by mapping and calls the consumer's
+#  pm_seg(v, p, n, t, a) : the n entries from page #p of mapping #v (va page #
+#                          a); t has them as od prints them, 17 chars each
+#  pm_run(v, p, n, ent)  : n entries from page #p of mapping #v, all the same,
+#                          ent (a run od printed as '*')
+# so the consumer can look at a line's worth of entries at a time - f.e.
+# count the present ones with one gsub() - not at each entry. For the PFNs,
+# pm_contig() tells if entries are on contiguous PFNs, and pm_pfnruns() hands
+# the present ones, as runs of contiguous PFNs, to the consumer's
+#  pm_pfns(v, pfn, cnt)
+# both without converting each PFN (all three must be defined, if empty: awk
+# insists). It sets up
+#  nm, vs[v], np[v] : the # of mappings, mapping #v's start (hex), # pages
+# Parameters:
+#  pagemap_list : $1 : the userspace segment table ; $2 : the list (output)
+#  pagemap_read : $1 : PID ; $2 : the list
+PAGEMAP_MAXGAP=$((1024*1024))
+pagemap_list()
+{
+awk -F"${gDELIM}" -v pgsz=${PAGE_SIZE} -v sparse="${SPARSE_ENTRY}" \
+    -v nulltrap="${NULLTRAP_STR}" -v loc="${LOCATED_REGION_ENTRY}" "${AWK_HEXLIB}"'
+$1 == sparse || $1 == nulltrap || $1 == loc || $1 == "[vsyscall]" { next }
+{
+  s = hex2dec($3) ; e = hex2dec($4)
+  printf("%s %.0f %.0f\n", $3, s/pgsz*8, (e-s)/pgsz)
+}' ${1} | sort -n -k2,2 > ${2}
+} # end pagemap_list()
 
-# Convert hex to dec
-local start_dec=$(printf "%llu" 0x${start_uva})
-local end_dec=$(printf "%llu" 0x${end_uva})
-local seg_sz=$(printf "%llu" $((end_dec-start_dec)))  # in bytes
+pagemap_read()
+{
+local off len
 
-local DetectedSparse=0
+# The spans: 'pagemap_offset #bytes'; page (ie. PMD-sized va) aligned, so the
+# 64 entry lines of od are aligned too
+awk -v al=${PAGE_SIZE} -v gap=${PAGEMAP_MAXGAP} '
+function flush() { if (e > s) printf("%.0f %.0f\n", s, e - s) }
+{
+  a = int($2/al)*al ; z = int(($2 + $3*8 + al-1)/al)*al
+  if (NR > 1 && a - e <= gap) { if (z > e) e = z ; next }
+  flush() ; s = a ; e = z
+}
+END { flush() }' ${2} | while IFS=" " read -r off len
+do
+   echo "@ ${off}"
+   dd if=/proc/$1/pagemap bs=1M iflag=skip_bytes,count_bytes skip=${off} \
+	count=${len} status=none 2>/dev/null | od -Ad -tx8 -w512
+done
+} # end pagemap_read()
 
-# The global 6d-array's format is:
-#          col0     col1      col2       col3   col4    col5
-# row'n' [segname],[size],[start_uva],[end_uva],[mode],[offset]
+export AWK_PAGEMAP='
+# The PFN of the entry e (a space and 16 hex digits): bits 0-54
+function pm_pfn(e) {
+  return (index("0123456789abcdef", substr(e, 4, 1)) - 1) % 8 * 2^52 + hex2dec(substr(e, 5))
+}
+# If the k (present) entries t are on k contiguous PFNs (within an aligned
+# block of 256), the first PFN, else 0. Such entries differ in just the last
+# two hex digits, counting up: so delete the rest (one gsub) and compare
+function pm_contig(t, k,   o, c) {
+  o = (index(pm_hx, substr(t, 16, 1)) - 1)*16 + index(pm_hx, substr(t, 17, 1)) - 1
+  if (o + k > 256) return 0
+  c = t
+  if (gsub(" " substr(t, 2, 14), " ", c) != k || c != substr(pm_suf, o*3 + 1, k*3))
+     return 0
+  return pm_pfn(substr(t, 1, 17))
+}
+# The k present entries t to pm_pfns(): whole, if on contiguous PFNs, else
+# halved (or split at the 256 block boundary); PFN 0 (not root) is skipped
+function pm_runs(v, t, k,   o, m, pfn) {
+  if ((pfn = pm_contig(t, k)) > 0) { pm_pfns(v, pfn, k) ; return }
+  if (k == 1) return
+  o = (index(pm_hx, substr(t, 16, 1)) - 1)*16 + index(pm_hx, substr(t, 17, 1)) - 1
+  m = (o + k > 256) ? 256 - o : int(k/2)
+  pm_runs(v, substr(t, 1, m*17), m)
+  pm_runs(v, substr(t, m*17 + 1), k - m)
+}
+# The present entries of t (of mapping #v), as runs of contiguous PFNs
+function pm_pfnruns(v, t,   c, j, pc) {
+  c = split(t, pc, / [0-7][0-9a-f]*/)
+  for (j = 1; j <= c; j++)
+     if (pc[j] != "") pm_runs(v, pc[j], length(pc[j]) / 17)
+}
+# The entries of va pages [a, b): t has them (the first being page # pk), or,
+# if t is "", they are all ent
+function pm_walk(a, b, t, ent, pk,   e) {
+  while (a < b) {
+     while (pj < nm && pe[pj] <= a) pj++
+     if (pj >= nm) return
+     if (a < ps[pj]) { a = ps[pj] ; continue }
+     e = (pe[pj] < b) ? pe[pj] : b
+     if (t == "") pm_run(pj, a - ps[pj], e - a, ent)
+     else pm_seg(pj, a - ps[pj], e - a, substr(t, (a-pk)*17 + 1, (e-a)*17), a)
+     a = e
+  }
+}
+BEGIN {
+  pm_hx = "0123456789abcdef" ; pm_suf = ""
+  for (pi = 0; pi < 256; pi++)
+     pm_suf = pm_suf " " substr(pm_hx, int(pi/16) + 1, 1) substr(pm_hx, pi%16 + 1, 1)
+  nm = 0
+  while ((getline ln < list) > 0) {
+     split(ln, f, " ")
+     vs[nm] = f[1] ; ps[nm] = f[2]/8 ; np[nm] = f[3] ; pe[nm] = ps[nm] + np[nm] ; nm++
+  }
+  close(list) ; pj = 0
+}
+$1 == "@" { pbase = $2 ; prep = 0 ; next }
+# od(1) (without -v) prints a "*" line in place of a run of identical lines;
+# this is a big win when scanning large, mostly not resident, mappings
+$1 == "*" { prep = 1 ; next }
+{
+  pk = (pbase + $1) / 8
+  if (prep) {	# the lines from plast+64 to pk-64 are the same as the last one
+     if (substr(plt, 1, 17) != pu) {
+        pu = substr(plt, 1, 17) ; pul = ""
+        for (pi = 0; pi < 64; pi++) pul = pul pu
+     }
+     if (plt == pul)
+        pm_walk(plast + 64, pk, "", pu, 0)
+     else
+        for (pi = plast + 64; pi < pk; pi += 64) pm_walk(pi, pi + 64, plt, "", pi)
+     prep = 0
+  }
+  if (NF < 2) next	# the end of the span: just the offset
+  plt = substr($0, length($1) + 1) ; plast = pk
+  pm_walk(pk, pk + NF - 1, plt, "", pk)
+}
+'
+
+#------------- r e s i d e n c y _ s c a n ------------------------------
+# The --residency option.
+# For each mapping in the userspace segment table, figure out how much of it is
+# actually resident in RAM, swapped out, backed by THP and file-backed (page
+# cache or shared anon), via the process's /proc/PID/pagemap (and, if we can
+# read it - it requires root - /proc/kpageflags, for THP).
+# The results are written as annotations (see graphit()) for the mapping:
+#  res  45.2%  swap   0.0%  thp  12.5%  file   0.0%  [1234 pages]
+#  heat [_________..::--==++**##%%@@@@@@@@@@@@@@@@@@@@@@@@@_______________]
+# The 'heat strip' is the mapping (lower va on the left, higher on the
+# right) divided into (upto) RES_STRIP_WIDTH buckets; each is shown as one of
+#  _.:-=+*#%@
+# from not resident at all ('_') to fully resident ('@').
+#
+# pagemap entry bits (Documentation/admin-guide/mm/pagemap.rst):
+#  63 present, 62 swapped, 61 file-page or shared-anon, 0-54 PFN (the PFN is
+#  zero unless we have CAP_SYS_ADMIN)
+# THP: the KPF_THP (22) bit of the kpageflags entry of each resident page's
+# PFN. kpageflags is read with one dd per run of physically contiguous pages;
+# if there are more than RES_KPF_MAXRUNS such runs (fragmented memory), we
+# instead estimate it (shown as ~x%) from pagemap alone: a PMD-sized, aligned,
+# block of va that's fully resident on a physically contiguous and aligned
+# block of PFNs is (very nearly always) a THP. Without the PFNs (not root),
+# thp is shown as '-'.
+#
+# Performance: the pagemap is read in one pass, with a handful of processes
+# (see pagemap_read()); the awk counts the present, swapped and file entries
+# of a line's worth (64) of them at a time with gsub(), and, for THP and the
+# kpageflags runs, finds the lines, or stretches of entries, on contiguous
+# PFNs with pm_contig() and pm_pfnruns(); it converts a PFN or two per such
+# stretch, not each.
+# Parameters:
+#  $1 : PID
+#  $2 : the userspace segment table (CSV, 6 fields/record)
+RES_STRIP_WIDTH=60
+RES_KPF_MAXRUNS=1024
+residency_scan()
+{
+local pagemap=/proc/$1/pagemap kpf=/proc/kpageflags use_kpf=0
+local list=/tmp/${name}/res.list res=/tmp/${name}/res.out
+local runs=/tmp/${name}/res.runs thp=/tmp/${name}/res.thp
+local pfn np
 
-if [ "${offset}" = "00000000" ]; then
-   offset="0"
+dd if=${pagemap} bs=8 count=1 of=/dev/null status=none 2>/dev/null || {
+   echo "[!] --residency: cannot read ${pagemap} (permissions?), skipping it"
+   return
+}
+[ -r ${kpf} ] && dd if=${kpf} bs=8 count=1 of=/dev/null status=none 2>/dev/null && use_kpf=1
+
+pagemap_list ${2} ${list}
+
+# Output: start resident swapped file thp_estimate #pages strip
+rm -f ${runs}
+pagemap_read $1 ${list} | \
+ awk -v list=${list} -v W=${RES_STRIP_WIDTH} -v kpf=${use_kpf} -v runsfile=${runs} \
+     -v maxruns=${RES_KPF_MAXRUNS} -v hp=$((PAGE_SIZE/8)) \
+     -v root=$([ $(id -u) -eq 0 ] && echo 1 || echo 0) "${AWK_HEXLIB}${AWK_PAGEMAP}"'
+BEGIN {
+  ramp = "_.:-=+*#%@" ; zero = " 0000000000000000"
+  for (v = 0; v < nm; v++) w[v] = (np[v] < W) ? np[v] : W
+  # the top hex digit of the entry has bits 63..60
+  for (d = 0; d < 16; d++) {
+     x = substr("0123456789abcdef", d+1, 1)
+     pres[x] = (d >= 8) ; swp[x] = (d >= 4 && d < 8) ; fil[x] = (d >= 8 && int(d/2) % 2)
+  }
+  nruns = 0 ; lastpfn = -2 ; tnext = -1
+}
+# Count the n entries from page #p of mapping #v, bucket by bucket (of the
+# strip); t has them, or, if t is "", they are all ent. Returns the # present
+function tally(v, p, n, t, ent,   i, q, m, s, c, tot) {
+  tot = 0
+  while (n > 0) {
+     i = int(p*w[v]/np[v])
+     q = int((i+1)*np[v]/w[v])	# the 1st page past bucket #i
+     while (int(q*w[v]/np[v]) <= i) q++
+     m = (q - p < n) ? q - p : n
+     if (t == "") {
+        c = pres[substr(ent, 2, 1)] * m
+        fp[v] += fil[substr(ent, 2, 1)] * m ; sp[v] += swp[substr(ent, 2, 1)] * m
+     } else {
+        s = substr(t, 1, m*17) ; t = substr(t, m*17 + 1)
+        if ((c = gsub(/ [89a-f]/, "&", s)) > 0) fp[v] += gsub(/ [abef]/, "&", s)
+        if (c < m) sp[v] += gsub(/ [4-7]/, "&", s)
+     }
+     rp[v] += c ; b[v, i] += c ; tot += c
+     p += m ; n -= m
+  }
+  return tot
+}
+# The next run of cnt physically contiguous pages, from PFN pfn, of mapping #v
+function pm_pfns(v, pfn, cnt) {
+  if (!kpf) return
+  if (pfn == lastpfn+1 && v == lastv)
+     runlen += cnt
+  else {
+     if (runlen) printf("%d %.0f %d\n", lastv, runstart, runlen) > runsfile
+     runstart = pfn ; runlen = cnt ; lastv = v
+     if (++nruns > maxruns) {   # too fragmented; estimate instead
+        kpf = 0 ; close(runsfile) ; printf("") > runsfile
+     }
+  }
+  lastpfn = pfn + cnt - 1
+}
+function pm_seg(v, p, n, t, a,   c, pfn) {
+  c = tally(v, p, n, t, "")
+  if (!root || !c) return
+  # THP estimate: a PMD-sized, aligned, block of va is eight (for 4k pages)
+  # lines, each fully present on 64 contiguous PFNs, the first PFN aligned
+  if (n == 64 && c == 64 && (pfn = pm_contig(t, 64)) > 0) {
+     if (a % hp == 0) { tok = (pfn % hp == 0) ; tv = v }
+     else if (!(tok && a == tnext && v == tv && pfn == tpfn + 64)) tok = 0
+     tnext = a + 64 ; tpfn = pfn
+     if (tok && tnext % hp == 0) thp_est[v] += hp
+     pm_pfns(v, pfn, 64)
+     return
+  }
+  tok = 0
+  if (kpf) pm_pfnruns(v, t)
+}
+function pm_run(v, p, n, ent,   pfn) {
+  if (ent == zero) return	# not present, not swapped
+  if (!tally(v, p, n, "", ent) || !root) return
+  tok = 0
+  if ((pfn = pm_pfn(ent)) > 0)
+     while (kpf && n-- > 0) pm_pfns(v, pfn, 1)
+}
+END {
+  if (kpf && runlen) printf("%d %.0f %d\n", lastv, runstart, runlen) > runsfile
+  for (v = 0; v < nm; v++) {
+     strip = ""
+     for (i = 0; i < w[v]; i++) {
+        c = int(b[v, i] * 9 / (int((i+1)*np[v]/w[v]) - int(i*np[v]/w[v])) + 0.999999)
+        strip = strip substr(ramp, c+1, 1)
+     }
+     printf("%s %d %d %d %d %d %s\n", vs[v], rp[v], sp[v], fp[v], thp_est[v], np[v], strip)
+  }
+}' > ${res}
+
+# THP: KPF_THP is bit 22 of the kpageflags entry
+if [ ${use_kpf} -eq 1 -a -s ${runs} ] ; then
+   while IFS=" " read -r _ pfn np
+   do
+	dd if=${kpf} bs=1M iflag=skip_bytes,count_bytes skip=$((pfn*8)) \
+	   count=$((np*8)) status=none 2>/dev/null || true
+   done < ${runs} | od -An -v -tx8 -w8 | \
+    awk -v runs=${runs} '
+    BEGIN {
+      while ((getline ln < runs) > 0) { split(ln, f, " ") ; rv[++n] = f[1] ; rl[n] = f[3] }
+      r = 1 ; left = rl[1]
+    }
+    {
+      while (left == 0 && r < n) left = rl[++r]
+      d = index("0123456789abcdef", substr($0, 2+10, 1)) - 1
+      if (int(d/4) % 2) thp[rv[r]]++
+      left--
+    }
+    END { for (v in thp) print v, thp[v] }' > ${thp}
+else
+   use_kpf=0
+   : > ${thp}
 fi
 
-# NOTE-
-# The '[vsyscall]' page is in kernel-space; hence, we only show it if
-# our config requires us to...; default is No
-if [ "${segment}" = "[vsyscall]" -a ${SHOW_VSYSCALL_PAGE} -eq 0 ]; then
-   decho "skipping [vsyscall] page..."
-   prevseg_start_uva=${start_dec}
-   prevseg_name="[vsyscall]"
+# Finally, write the annotations
+awk -v thpfile=${thp} -v kpf=${use_kpf} -v root=$([ $(id -u) -eq 0 ] && echo 1 || echo 0) '
+BEGIN { while ((getline ln < thpfile) > 0) { split(ln, f, " ") ; thp[f[1]] = f[2] } }
+{
+  pct = ($6 > 0) ? 100/$6 : 0
+  if (kpf) t = sprintf(" %5.1f%%", thp[NR-1] * pct)
+  else if (root) t = sprintf("~%5.1f%%", $5 * pct)
+  else t = "     - "
+  printf("%s,res %5.1f%%  swap %5.1f%%  thp %s  file %5.1f%%  [%d pages]\n",
+	$1, $2*pct, $3*pct, t, $4*pct, $6)
+  printf("%s,heat [%s]\n", $1, $7)
+}' ${res} >> ${ANNOTFILE}
+[ ${DEBUG} -eq 0 ] && rm -f ${list} ${res} ${runs} ${thp} || true
+} # end residency_scan()
+
+#------------- w s s _ s c a n ------------------------------------------
+# The --wss=SECONDS option: working set estimation, per mapping.
+# Residency isn't hotness; here we mark the process's pages idle, wait for
+# the interval and then see which of them were accessed meanwhile, via idle
+# page tracking (${PAGE_IDLE_BITMAP}; needs CONFIG_IDLE_PAGE_TRACKING and
+# root) or, when that's unavailable, via the procmap kernel module's
+# accessed-bit walk (${DBGFS_ACC_FILENAME}). The results are annotations (see
+# graphit()) for each mapping with resident pages:
+#  wss 12.3 MB  (45.2% of the 27.2 MB resident) in 10s
+# plus a summary, ${WSSSTATS}, shown after the map.
+#
+# Performance (idle page tracking): the PFNs of the resident pages are read
+# from the pagemap in one pass (see pagemap_read()), as runs of physically
+# contiguous pages, and sorted; then the page_idle bitmap - 8 bytes per 64
+# PFNs, so just 4 MB for 128 GB of RAM - is written (all of it that spans the
+# PFNs) with one dd(1), and, after the interval, read back with one dd(1) and
+# merged against the sorted runs in one awk pass (a whole word of the bitmap
+# at a time where a run covers it). So a constant, small, # of processes and
+# large I/Os whatever the size of the process. (Marking the pages of the span
+# idle affects other users of idle page tracking; as any WSS tool using it
+# does.)
+# Parameters:
+#  $1 : PID
+#  $2 : the interval (seconds)
+#  $3 : the userspace segment table (CSV, 6 fields/record)
+wss_scan()
+{
+local pagemap=/proc/$1/pagemap accf=${DBGFS_LOC}/${KMOD}/${DBGFS_ACC_FILENAME}
+local list=/tmp/${name}/wss.list pfns=/tmp/${name}/wss.pfns res=/tmp/${name}/wss.out
+local np w0 w1 nbytes
+
+rm -f ${WSSSTATS}
+if [ -w ${PAGE_IDLE_BITMAP} ] && \
+   dd if=${pagemap} bs=8 count=1 of=/dev/null status=none 2>/dev/null ; then
+   pagemap_list ${3} ${list}
+
+   # The resident pages, as runs of contiguous PFNs: 'pfn #pages mapping#',
+   # in PFN order
+   pagemap_read $1 ${list} | \
+    awk -v list=${list} "${AWK_HEXLIB}${AWK_PAGEMAP}"'
+   function pm_pfns(v, pfn, cnt) {
+     if (pfn == lastpfn+1 && v == lastv)
+        runlen += cnt
+     else {
+        if (runlen) printf("%.0f %d %d\n", runstart, runlen, lastv)
+        runstart = pfn ; runlen = cnt ; lastv = v
+     }
+     lastpfn = pfn + cnt - 1
+   }
+   function pm_seg(v, p, n, t, a) {
+     if (gsub(/ [89a-f]/, "&", t)) pm_pfnruns(v, t)
+   }
+   # a run of identical entries: not present, or PFN 0 (not root)
+   function pm_run(v, p, n, ent) { }
+   BEGIN { lastpfn = -2 }
+   END { if (runlen) printf("%.0f %d %d\n", runstart, runlen, lastv) }' | \
+    sort -n -k1,1 > ${pfns}
+
+   [ -s ${pfns} ] || {
+      echo "[!] --wss: no resident pages (or no PFNs: needs root), skipping it"
+      rm -f ${list} ${pfns}
+      return
+   }
+   IFS=" " read -r w0 _ < ${pfns}
+   IFS=" " read -r w1 np _ <<< "$(tail -n1 ${pfns})"
+   w0=$((w0/64)) ; w1=$(((w1+np-1)/64)) ; nbytes=$(((w1-w0+1)*8))
+
+   # Mark them all idle; then wait, and read back which are still idle
+   head -c ${nbytes} /dev/zero | tr '\0' '\377' | \
+	dd of=${PAGE_IDLE_BITMAP} bs=1M iflag=fullblock oflag=seek_bytes seek=$((w0*8)) \
+	   conv=notrunc status=none 2>/dev/null || {
+      echo "[!] --wss: writing ${PAGE_IDLE_BITMAP} failed, skipping it"
+      rm -f ${list} ${pfns}
+      return
+   }
+   echo "[i] --wss: measuring the working set over ${2}s ..." 1>&2
+   sleep ${2}
+   dd if=${PAGE_IDLE_BITMAP} bs=1M iflag=skip_bytes,count_bytes skip=$((w0*8)) \
+      count=${nbytes} status=none 2>/dev/null | od -An -v -tx8 -w8 | \
+    awk -v pfns=${pfns} -v list=${list} -v w0=${w0} '
+   BEGIN {
+     # the # of bits set in a hex digit
+     for (d = 0; d < 16; d++)
+        nb[substr("0123456789abcdef", d+1, 1)] = int(d/8) + int(d/4)%2 + int(d/2)%2 + d%2
+     n = 0
+     while ((getline ln < list) > 0) { split(ln, f, " ") ; vs[n++] = f[1] }
+     more = ((getline ln < pfns) > 0) ; split(ln, r, " ")
+   }
+   # r[] is (what is left of) the current run: pfn #pages mapping#
+   {
+     w = w0 + NR - 1
+     while (more && r[1] < (w+1)*64) {
+        a = r[1] - w*64 ; b = a + r[2] ; if (b > 64) b = 64
+        idle = 0
+        if (a == 0 && b == 64)
+           for (i = 1; i <= 16; i++) idle += nb[substr($1, i, 1)]
+        else
+           for (i = a; i < b; i++)
+              idle += int((index("0123456789abcdef", substr($1, 16 - int(i/4), 1)) - 1) / 2^(i%4)) % 2
+        res[r[3]] += b - a ; acc[r[3]] += b - a - idle   # not idle: accessed
+        r[1] += b - a ; r[2] -= b - a
+        if (r[2] > 0) break
+        more = ((getline ln < pfns) > 0) ; split(ln, r, " ")
+     }
+   }
+   END { for (v = 0; v < n; v++) if (res[v]) print vs[v], acc[v]+0, res[v] }' > ${res}
+elif [ "${PROC_ROOT}" = "/proc" -a -w ${accf} ] ; then
+   # The kernel module: the 1st walk clears the accessed bits, the 2nd counts them
+   { exec 3<>${accf} ; } 2>/dev/null && echo $1 >&3 2>/dev/null && cat <&3 >/dev/null 2>&1 || {
+      exec 3>&-
+      echo "[!] --wss: the kernel module's accessed-bit walk failed, skipping it"
+      return
+   }
+   exec 3>&-
+   echo "[i] --wss: measuring the working set over ${2}s ..." 1>&2
+   sleep ${2}
+   { exec 3<>${accf} ; } 2>/dev/null
+   echo $1 >&3 2>/dev/null
+   # start end present_ptes young_ptes pmd_leaves young_pmd_leaves
+   cat <&3 2>/dev/null | awk -v hp=$((PAGE_SIZE/8)) '
+   NF == 6 && ($3 + $5) > 0 { print $1, $4 + $6*hp, $3 + $5*hp }' > ${res}
+   exec 3>&-
+else
+   echo "[!] --wss: needs idle page tracking (${PAGE_IDLE_BITMAP}) or the procmap kernel module, and root; skipping it"
    return
 fi
 
-#------------ Sparse Detection
-if [ ${SPARSE_SHOW} -eq 1 ]; then
-
- decho "
-$2: seg=${segment} prevseg_name=${prevseg_name} ,  gRow=${gRow} "
-
- # Detect sparse region, and if present, insert into the gArr[].
- # Sparse region detected by condition:
- #  gap = this-segment-start - prev-segment-end > 1 page
- # Wait! With order by Descending va, we should take the prev segment's
- # start uva (not the end uva)!
- #  gap = prev_seg_start - this-segment-end > 1 page
-
- if [ "${segment}" != "[vsyscall]" ]; then
-   #decho "end_dec=${end_dec} prevseg_start_uva=${prevseg_start_uva}"
-   gap=$((${prevseg_start_uva}-${end_dec}))
-   local gap_hex=$(printf "0x%llx" ${gap})
-   decho "gap = ${gap}"
-   [ ${gap} -gt ${PAGE_SIZE} ] && DetectedSparse=1
- fi
-
- if [ ${DetectedSparse} -eq 1 -a "${prevseg_name}" != "[vsyscall]" ]; then
-   local prevseg_start_uva_hex=$(printf "%llx" ${prevseg_start_uva})
-   local sparse_start_uva_dec=$((${prevseg_start_uva}-${gap}))
-#   local sparse_start_uva=$((0x${prevseg_start_uva_hex}-${gap_hex}))
-   local sparse_start_uva=$(printf "%llx" ${sparse_start_uva_dec})
-   decho "prevseg_start_uva_hex=${prevseg_start_uva_hex}  gap = ${gap_hex} sparse_start_uva=${sparse_start_uva}"
-   #prompt
- 
-   append_userspace_mapping "${SPARSE_ENTRY}" ${gap} ${sparse_start_uva} \
-      ${prevseg_start_uva_hex} "----" 0
-
-   inc_sparse ${gap}
- fi
-
- prevseg_start_uva=${start_dec}
-fi
-#--------------
-
-#if [ ${DetectedSparse} -eq 0 ]; then
-#--- Populate the global array
-append_userspace_mapping "${segment}" ${seg_sz} ${start_uva} \
-     ${end_uva} "${mode}" ${offset}
-
-prevseg_name=${segment}
-#decho "prevseg_name = ${prevseg_name}
-#"
-} # end interpret_user_rec()
-
-# query_highest_valid_uva()
-# Require the topmost valid userspace va, query it from the o/p of our
-# prep_mapfile.sh script
-# TODO : ARCH SPECIFIC !!
-query_highest_valid_uva()
+# The annotations, and the summary
+awk -v pgsz=${PAGE_SIZE} -v iv=${2} -v statsf=${WSSSTATS} "${AWK_HEXLIB}"'
 {
-local TMPF=/tmp/${name}/qhva
-awk -F"${gDELIM}" '{print $2}' ${gINFILE} > ${TMPF}
-[ ! -s ${TMPF} ] && {
-  warn "couldn't fetch highest valid uva, aborting..."
-  return
+  printf("%s,wss %s  (%.1f%% of the %s resident) in %ss\n", $1, hsz($2*pgsz),
+	 $2*100/$3, hsz($3*pgsz), iv)
+  acc += $2 ; res += $3 ; if ($2 == 0) ncold++
 }
-
-#set -x
- local va
- for va in $(cat ${TMPF})
- do 
-   decho "va: $va"
-   local va_dec=$(printf "%llu" 0x${va})
-   if (( $(echo "${va_dec} < ${END_UVA_DEC}" |bc -l) )); then
-     HIGHEST_VALID_UVA=${va}
-	 rm -f ${TMPF}
-	 return
-   fi
- done
- HIGHEST_VALID_UVA=0x0
-#set +x
- rm -f ${TMPF}
-} # end query_highest_valid_uva()
-
-# Setup the userspace Sparse region at the very top (high) end of the VAS
-# in the gArray[]
-# TODO : ARCH SPECIFIC !!
-setup_usparse_top()
+END {
+  printf("\nWorking set (accessed in %ss): %s of the %s resident (%.1f%%);\n", iv,
+	 hsz(acc*pgsz), hsz(res*pgsz), res ? acc*100/res : 0) > statsf
+  printf(" %d of %d resident mappings were not accessed at all\n", ncold, NR) > statsf
+}' ${res} >> ${ANNOTFILE}
+[ ${DEBUG} -eq 0 ] && rm -f ${list} ${pfns} ${res} || true
+} # end wss_scan()
+
+#------------- s m a p s _ p e r _ v m a --------------------------------
+# Per mapping memory cost, from /proc/PID/smaps, in a single streaming pass.
+# Writes, for each VMA, a record (all sizes in KB):
+#  start_uva,Rss,Pss,Swap,AnonHugePages,Locked
+# into the file passed; the start uva is in hex w/o leading 0s, as in the
+# segment table (so that it serves as the key to join the two).
+# Parameters:
+#  $1 : PID
+#  $2 : output file
+smaps_per_vma()
 {
- gRow=0
- query_highest_valid_uva
- local HIGHEST_VALID_UVA_DEC=$(printf "%llu" 0x${HIGHEST_VALID_UVA})
+awk -v OFS="${gDELIM}" '
+function flush() { if (key != "") print key, rss+0, pss+0, swp+0, ahp+0, lck+0 }
+/^[0-9a-f]+-[0-9a-f]+ / {
+  flush()
+  key = substr($1, 1, index($1, "-")-1) ; sub(/^0+/, "", key) ; if (key == "") key = "0"
+  rss = pss = swp = ahp = lck = 0
+  next
+}
+$1 == "Rss:" { rss = $2 ; next }
+$1 == "Pss:" { pss = $2 ; next }
+$1 == "Swap:" { swp = $2 ; next }
+$1 == "AnonHugePages:" { ahp = $2 ; next }
+$1 == "Locked:" { lck = $2 ; next }
+END { flush() }' ${PROC_ROOT}/$1/smaps > ${2} 2>/dev/null || {
+  echo "[!] reading ${PROC_ROOT}/$1/smaps failed (permissions?)"
+  : > ${2}
+}
+} # end smaps_per_vma()
+
+#------------- n u m a _ p e r _ v m a ----------------------------------
+# The --numa option: NUMA placement per mapping, from /proc/PID/numa_maps, in
+# a single streaming pass. For each mapping with pages present, an annotation
+# (see graphit()) with it's memory policy and the memory on each node:
+#  numa default  N0 1234 KB  N1 56 KB  remote 4%
+# A node is 'local' if it has any of the CPUs the task may run on
+# (Cpus_allowed_list in /proc/PID/status); mappings with more than
+# NUMA_REMOTE_PCT % of their memory on remote nodes are flagged.
+# The per node totals are written to ${NUMASTATS}, shown after the map.
+# Parameters:
+#  $1 : PID
+numa_per_vma()
+{
+local numamaps=${PROC_ROOT}/$1/numa_maps f n c nodes=""
+rm -f ${NUMASTATS}
+[ -r ${numamaps} ] || {
+   echo "[!] --numa: cannot read ${numamaps} (no NUMA support? permissions?), skipping it"
+   return
+}
+# 'node:cpulist' of each node
+for f in /sys/devices/system/node/node[0-9]*/cpulist ; do
+   [ -r ${f} ] || continue
+   n=${f%/cpulist} ; n=${n##*node}
+   IFS= read -r c < ${f} || c=""
+   nodes="${nodes} ${n}:${c}"
+done
 
- decho "HIGHEST_VALID_UVA = ${HIGHEST_VALID_UVA}"
+awk -v nodes="${nodes}" -v rpct=${NUMA_REMOTE_PCT} -v statsf=${NUMASTATS} "${AWK_HEXLIB}"'
+# Expand the CPU list (f.e. 0-3,8-11) into the array a[]
+function expand(list, a,   k, i, r, c) {
+  k = split(list, parts, ",")
+  for (i = 1; i <= k; i++) {
+    if (split(parts[i], r, "-") == 1) r[2] = r[1]
+    for (c = r[1]+0; c <= r[2]+0; c++) a[c] = 1
+  }
+}
+FNR == NR {
+  if ($1 == "Cpus_allowed_list:") expand($2, allowed)
+  next
+}
+FNR == 1 {   # the status is done; which nodes are local?
+  nn = split(nodes, nl, " ")
+  for (i = 1; i <= nn; i++) {
+    split(nl[i], p, ":") ; nodeid = p[1] ; nodecpus[nodeid] = 1
+    delete ncpu ; expand(p[2], ncpu)
+    for (c in ncpu) if (c in allowed) { local[nodeid] = 1 ; break }
+  }
+}
+{
+  key = $1 ; sub(/^0+/, "", key) ; if (key == "") key = "0"
+  pol = $2 ; kps = 4 ; tot = rem = 0 ; line = ""
+  delete pg
+  for (i = 3; i <= NF; i++) {
+    if ($i ~ /^kernelpagesize_kB=/) kps = substr($i, 19) + 0
+    else if ($i ~ /^N[0-9]+=/) {
+      split(substr($i, 2), p, "=") ; pg[p[1]] = p[2]
+    }
+  }
+  for (nd in pg) {
+    kb = pg[nd] * kps ; tot += kb ; node_kb[nd] += kb
+    if (!(nd in local)) rem += kb
+  }
+  if (tot == 0) next
+  for (nd = 0; nd <= 1024 && length(line) < 50; nd++)
+    if (nd in pg) line = line sprintf("  N%d %s", nd, hsz(pg[nd] * kps * 1024))
+  printf("%s,numa %s%s  remote %d%%%s\n", key, pol, line, rem*100/tot,
+	 (rem*100/tot > rpct) ? "  <-- REMOTE!" : "")
+  if (rem*100/tot > rpct) nremote++
+}
+END {
+  for (nd in node_kb) { all += node_kb[nd] ; if (!(nd in local)) allrem += node_kb[nd] }
+  printf("\nNUMA placement (local nodes: those with CPUs the task may run on):\n") > statsf
+  for (nd = 0; nd <= 1024; nd++) {
+    if (!(nd in node_kb)) continue
+    printf(" node %-3d %-6s %12s  (%5.1f%%)\n", nd, (nd in local) ? "local" : "remote",
+	   hsz(node_kb[nd] * 1024), all ? node_kb[nd]*100/all : 0) > statsf
+  }
+  printf(" remote: %s (%.1f%%); %d mapping(s) mostly remote (> %d%%)\n", hsz(allrem * 1024),
+	 all ? allrem*100/all : 0, nremote, rpct) > statsf
+}' ${PROC_ROOT}/$1/status ${numamaps} >> ${ANNOTFILE} 2>/dev/null || {
+  echo "[!] --numa: reading ${numamaps} failed"
+  rm -f ${NUMASTATS}
+}
+} # end numa_per_vma()
+
+#------------- t h r e a d _ s t a c k s --------------------------------
+# The --threads option: attribute the thread stacks. For each task (thread)
+# of the process, it's stack pointer - from /proc/PID/task/TID/syscall (the
+# task's user SP while it's blocked; needs ptrace access), else the kstkesp
+# of task/TID/stat (nonzero only while dumping core) - is looked up (binary
+# search) in the segment table. Stack mappings (anonymous ones) are renamed
+# [stack:TID], as the kernel once did in maps, and annotated (see graphit())
+# with the thread's name and how much of the stack's in use below it's top;
+# the PROT_NONE mapping just below a stack is annotated as it's guard. The
+# totals - committed stack memory, it's Rss (if we have the smaps) and the
+# guard overhead - are written to ${THREADSTATS}, shown after the map.
+# It's a single pass over the task directory: one find+grep feeds all the
+# tasks' stat and syscall lines to one awk (so it scales to thousands of
+# threads; tasks that exit meanwhile are just skipped).
+# Parameters:
+#  $1 : PID
+#  $2 : the userspace segment table (CSV, 6 fields/record; updated in place)
+thread_stacks()
+{
+local taskdir=${PROC_ROOT}/$1/task smaps=${SMAPSFILE}
+rm -f ${THREADSTATS}
+[ -d ${taskdir} ] || {
+   echo "[!] --threads: no ${taskdir} (a snapshot?), skipping it"
+   return
+}
+[ -s ${smaps} ] || smaps=/dev/null
+
+(cd ${taskdir} && find . -mindepth 2 -maxdepth 2 \( -name stat -o -name syscall \) \
+	-exec grep -H "" {} + 2>/dev/null || true) | \
+awk -v table=${2} -v smaps=${smaps} -v annotf=${ANNOTFILE} -v statsf=${THREADSTATS} \
+    -v sparse_entry="${SPARSE_ENTRY}" -v nulltrap="${NULLTRAP_STR}" "${AWK_HEXLIB}"'
+# Binary search of the (descending va) table for the mapping containing va;
+# returns the row #, else 0
+function lookup(va,   lo, hi, mid) {
+  lo = 1 ; hi = nrows
+  while (lo <= hi) {
+    mid = int((lo + hi) / 2)
+    if (va < vs[mid]) lo = mid + 1
+    else if (va >= ve[mid]) hi = mid - 1
+    else return mid
+  }
+  return 0
+}
+# Input lines: ./TID/stat:... or ./TID/syscall:...
+{
+  i = index($0, ":") ; fn = substr($0, 1, i-1) ; line = substr($0, i+1)
+  split(fn, p, "/") ; tid = p[2]
+  if (p[3] == "stat") {
+    # TID (comm) state ...; the comm may itself contain spaces and parens
+    c1 = index(line, "(") ; r = line ; off = 0
+    while ((i = index(r, ")")) > 0) { off += i ; r = substr(r, i+1) }
+    comm[tid] = substr(line, c1+1, off-c1-1)
+    split(r, s, " ")   # s[1] is field 3 (state), so field N is s[N-2]
+    if (s[27]+0 > 0 && !(tid in sp)) sp[tid] = s[27]+0   # kstkesp
+    ntask++
+  } else if (line != "running") {
+    # nr args... sp pc ; or -1 sp pc (blocked, but not in a syscall)
+    n = split(line, s, " ")
+    if (n >= 3) sp[tid] = hex2dec(s[n-1])
+  }
+}
+END {
+  while ((getline l < table) > 0) {
+    nrows++ ; row[nrows] = l ; split(l, f, ",")
+    nm[nrows] = f[1] ; vs[nrows] = hex2dec(f[3]) ; ve[nrows] = hex2dec(f[4])
+    key[nrows] = f[3] ; mode[nrows] = f[5]
+  }
+  close(table)
+  while ((getline l < smaps) > 0) { split(l, f, ",") ; rss[f[1]] = f[2] }
+
+  for (tid in comm) {
+    if (!(tid in sp) || sp[tid] == 0) { nosp++ ; continue }
+    r = lookup(sp[tid])
+    if (r == 0 || nm[r] == sparse_entry || nm[r] == nulltrap) { nomap++ ; continue }
+    nthr[r]++
+    # the lowest TID names the stack; the main thread is the lowest
+    if (!(r in first) || tid+0 < first[r]+0) first[r] = tid
+    if (nthr[r] <= 3)
+      printf("%s,thread %d (%s)  sp 0x%s  in use %s of %s\n", key[r], tid, comm[tid],
+	     dec2hex(sp[tid]), hsz(ve[r]-sp[tid]), hsz(ve[r]-vs[r])) >> annotf
+    else if (nthr[r] == 4)
+      more[r] = 1
+  }
+  for (r in first) {
+    nstk++ ; kb = (ve[r]-vs[r])/1024 ; stk_kb += kb ; stk_rss += rss[key[r]]
+    if (r in more) printf("%s,(+%d more threads)\n", key[r], nthr[r]-3) >> annotf
+    if (nm[r] == " [-unnamed-] ") { nm[r] = "[stack:" first[r] "]" ; renamed = 1 }
+    # the guard: PROT_NONE, right below the stack (the next row)
+    g = r + 1
+    if (g <= nrows && ve[g] == vs[r] && mode[g] ~ /^---/ && nm[g] == " [-unnamed-] ") {
+      printf("%s,guard of the stack of thread %d\n", key[g], first[r]) >> annotf
+      nguard++ ; guard_kb += (ve[g]-vs[g])/1024
+    }
+  }
+  # the table, with the stacks renamed, to stdout (only if any were)
+  if (renamed) {
+    for (r = 1; r <= nrows; r++) {
+      if (r in first) {
+        l = row[r] ; sub(/^[^,]*/, "", l) ; print nm[r] l
+      } else
+        print row[r]
+    }
+  }
 
- [ ${HIGHEST_VALID_UVA_DEC} -eq 0 ] && {
-  echo "Warning! couldn't fetch highest valid uva, aborting..."
+  printf("\nThread stacks: %d thread(s); %d stack mapping(s) located\n", ntask, nstk) > statsf
+  printf(" committed stack memory: %s", hsz(stk_kb * 1024)) > statsf
+  if (smaps != "/dev/null") printf(" (%s resident)", hsz(stk_rss * 1024)) > statsf
+  printf("\n guard pages: %d mapping(s), %s (%.2f%% of the stack memory)\n", nguard,
+	 hsz(guard_kb * 1024), stk_kb ? guard_kb*100/stk_kb : 0) > statsf
+  if (nosp)
+    printf(" %d thread(s) with no stack pointer to go by (running, or no ptrace access)\n", nosp) > statsf
+  if (nomap)
+    printf(" %d thread(s) with the stack pointer outside of any mapping (?)\n", nomap) > statsf
+}' > ${2}.tmp || {
+  echo "[!] --threads: attributing the thread stacks failed"
+  rm -f ${THREADSTATS} ${2}.tmp
   return
 }
-
- local gap_dec=$(bc <<< "(${END_UVA_DEC}-${HIGHEST_VALID_UVA_DEC})")
- if [ ${gap_dec} -gt ${PAGE_SIZE} ]; then
-  append_userspace_mapping "${SPARSE_ENTRY}" "${gap_dec}" ${HIGHEST_VALID_UVA} \
-     "${END_UVA}" "----" 0
-
-  inc_sparse ${gap_dec}
- fi
-} # end setup_usparse_top()
+if [ -s ${2}.tmp ] ; then
+   mv -f ${2}.tmp ${2}
+else
+   rm -f ${2}.tmp
+fi
+} # end thread_stacks()
+
+#------------- c o l l a p s e _ u s e r _ s e g t a b l e -------------
+# The --collapse option: for huge maps (f.e. 100k anonymous arena or JIT
+# mappings), merge each run of adjacent mappings of the same group - the same
+# backing file, or, for anonymous memory, the same permission class - into one
+# summary box; the (sparse) gaps within a run are folded in too. So the graph
+# grows with the # of distinct groups, not the # of mappings. The box spans
+# the whole run (permissions that differ within it are shown as *) and is
+# annotated (see graphit()) with the # of mappings, the memory actually
+# mapped, the internal gaps and, if we have them, the summed smaps costs; runs
+# shorter than COLLAPSE_MIN mappings are left as is. It's a single streaming
+# pass over the (va ordered) segment table; the full detail remains in it
+# (and so, with --export-maps, in the export).
+# Parameters:
+#  $1 : the userspace segment table (CSV, 6 fields/record)
+#  $2 : output: the collapsed table; it's annotations go to $2.annot
+collapse_user_segtable()
+{
+local smaps=${SMAPSFILE}
+[ -s ${smaps} ] || smaps=/dev/null
+awk -F"${gDELIM}" -v OFS="${gDELIM}" -v minrun=${COLLAPSE_MIN} -v annotf=${2}.annot \
+    -v sparse_entry="${SPARSE_ENTRY}" -v smaps=${smaps} -v annotin=${ANNOTFILE} "${AWK_HEXLIB}"'
+# The group: the backing file (or [heap], etc); for anonymous memory, it is
+# the permission class - executable (JIT code) or not, private or shared - so
+# that f.e. the arenas and their (---) guard regions all collapse together
+function grpkey(nm, mode) {
+  if (nm == " [-unnamed-] ") return "anon " ((mode ~ /x/) ? "x" : "-") substr(mode, 4, 1)
+  return nm
+}
+# Emit the pending sparse (gap) rows, as is
+function flush_gaps(   i) {
+  for (i = 1; i <= ngap; i++) print gaprow[i]
+  ngap = 0
+}
+# Emit the current run: as is if it is short, else as one (summary) row
+function flush_run(   i, k, m, sz) {
+  if (nrun == 0) return
+  if (nrun < minrun) {
+     for (i = 1; i <= nrun; i++) print runrow[i]
+  } else {
+     split(runrow[nrun], lo, ",")        # the lowest mapping (the run is in descending va order)
+     m = runmode
+     sz = hex2dec(top) - hex2dec(lo[3])
+     print runname, sprintf("%.0f", sz), lo[3], top, m, lo[6]
+     if (nrgaps)
+        printf("%s,x %d mappings  mapped %s  gaps %d (%s, largest %s)\n", lo[3], nrun,
+	       hsz(mapped), nrgaps, hsz(gapsz), hsz(maxgap)) > annotf
+     else
+        printf("%s,x %d mappings  mapped %s  no gaps\n", lo[3], nrun, hsz(mapped)) > annotf
+     if (smrss + smswap > 0)
+        printf("%s,rss %d KB  pss %d KB  swap %d KB  thp %d KB  locked %d KB\n", lo[3],
+	       smrss, smpss, smswap, smthp, smlck) > annotf
+     for (i = 1; i <= nrun; i++) {
+        split(runrow[i], f, ",") ; member[f[3]] = 1
+     }
+  }
+  nrun = 0
+}
+BEGIN {
+  while ((getline ln < smaps) > 0) {
+    split(ln, f, ",") ; sm[f[1]] = ln
+  }
+  close(smaps)
+}
+{
+  if ($1 == sparse_entry) {
+     if (nrun > 0) gaprow[++ngap] = $0
+     else print
+     next
+  }
+  k = grpkey($1, $5)
+  if ($5 !~ /^[-r][-w][-x][ps]$/ || substr($1, 1, 1) == "<") k = ""   # the NULL trap, --locate
+  if (nrun > 0 && k != "" && k == runkey) {   # the run continues; the gaps are internal
+     for (i = 1; i <= ngap; i++) {
+        split(gaprow[i], f, ",") ; nrgaps++ ; gapsz += f[2]
+        if (f[2] > maxgap) maxgap = f[2]
+     }
+     ngap = 0
+     if (runmode != $5) {   # mixed permissions: show the differing ones as *
+        m = ""
+        for (i = 1; i <= 4; i++)
+           m = m ((substr(runmode, i, 1) == substr($5, i, 1)) ? substr($5, i, 1) : "*")
+        runmode = m
+     }
+  } else {
+     flush_run() ; flush_gaps()
+     if (k == "") { print ; next }
+     runkey = k ; runname = $1 ; runmode = $5 ; top = $4
+     mapped = nrgaps = gapsz = maxgap = 0
+     smrss = smpss = smswap = smthp = smlck = 0
+  }
+  runrow[++nrun] = $0 ; mapped += $2
+  if ($3 in sm) {
+     split(sm[$3], f, ",")
+     smrss += f[2] ; smpss += f[3] ; smswap += f[4] ; smthp += f[5] ; smlck += f[6]
+  }
+}
+END {
+  flush_run() ; flush_gaps()
+  close(annotf)
+  # The other annotations, bar those of the mappings now within a summary box
+  while ((getline ln < annotin) > 0) {
+    k = ln ; sub(/,.*/, "", k)
+    if (!(k in member)) print ln >> annotf
+  }
+}' ${1} > ${2}
+} # end collapse_user_segtable()
 
 disp_fmt()
 {
@@ -322,22 +1042,6 @@ disp_fmt()
  fi
 }
 
-total_size_userspc()
-{
-local TMPF=/tmp/${name}/pmutmp
-showArray 1 > ${TMPF}
-# rm first header line and lines with 'Sparse' in them..
-sed --in-place '1,3d' ${TMPF}
-sed --in-place '/Sparse/d' ${TMPF}
-# rm last line, it has the null trap page
-sed --in-place '$d' ${TMPF}
-
-# cumulatively total the 2nd field, the size
-gTotalSegSize=$(awk -F, 'total+=$2 ; END {print total}' ${TMPF} |tail -n1)
-#echo "gTotalSegSize = ${gTotalSegSize} bytes"
-[ ${DEBUG} -eq 0 ] && rm -f ${TMPF}
-}
-
 # footer_stats_etc()
 # Write a footer, addn details if in verbose mode, show the 'statistics' as
 # required. Also, check for work like --export-map= ...
@@ -379,13 +1083,24 @@ disp_fmt
 +++-------------- Kernel-User boundary --------------+++
 @EOF@
     fi
-	cat /tmp/${name}/pmkfinal /tmp/${name}/.kusep /tmp/${name}/pmufinal > ${XMAP_FILE} #2>/dev/null
+	# Userspace rows get the smaps columns appended (0 for sparse regions, etc)
+	cat /tmp/${name}/pmkfinal /tmp/${name}/.kusep > ${XMAP_FILE} #2>/dev/null
+	[ -f /tmp/${name}/pmufinal ] && {
+	  awk -F"${gDELIM}" -v OFS="${gDELIM}" -v smaps=${SMAPSFILE} '
+	  BEGIN {
+	    while ((getline ln < smaps) > 0) {
+	      split(ln, f, ",") ; sm[f[1]] = f[2] "," f[3] "," f[4] "," f[5] "," f[6]
+	    }
+	  }
+	  { print $0, (($3 in sm) ? sm[$3] : "0,0,0,0,0") }' /tmp/${name}/pmufinal >> ${XMAP_FILE}
+	}
     if [ -s /tmp/${name}/pmkfinal -o -s /tmp/${name}/pmufinal ] ; then
       # Perform multiple ops w/ sed on the file; 1i inserts a line at the top
       sed --in-place -e "1i# Generated by procmap   (c) kaiwanTECH\n\
 # ${PRJ_URL}\n\
 # Via the --export-maps=<fname> option\n\
-# CSV format:\n# name,size,start_va,end_va,perms[u:maptype],[u:0xfile-offset]\n" ${XMAP_FILE}
+# CSV format:\n# name,size,start_va,end_va,perms[u:maptype],[u:0xfile-offset],\
+[u:Rss,Pss,Swap,AnonHugePages,Locked (KB)]\n" ${XMAP_FILE}
       echo "[i] Maps info written to file ${XMAP_FILE} (as CSV)."
 	fi
  fi
@@ -399,6 +1114,7 @@ main_wrapper()
  local PID=$1
  local szKB szMB szGB
 
+ timing_start
  prep_file
  get_range_info
  export IFS=$'\n'
@@ -413,14 +1129,14 @@ main_wrapper()
 
  # If we can't get the real name via /proc/pid/exe, fallback to using /proc/pid/status and 'which'
  [[ -z "${PRCS_PATHNAME}" ]] && {
-   PRCS_PATHNAME=$(realpath /proc/${PID}/exe 2>/dev/null) || {
-      local name=$(grep "^Name" /proc/${PID}/status |cut -d: -f2|xargs)  #|xargs to trim whitespace!
+   PRCS_PATHNAME=$(realpath ${PROC_ROOT}/${PID}/exe 2>/dev/null) || {
+      local name=$(grep "^Name" ${PROC_ROOT}/${PID}/status |cut -d: -f2|xargs)  #|xargs to trim whitespace!
       PRCS_PATHNAME=$(which ${name})
    }
  }
  # PARENT_PROCESS is the orig PID
- PRCS_NAME=$(cat /proc/${PARENT_PROCESS}/comm 2>/dev/null) || \
-    PRCS_NAME=$(grep "^Name" /proc/${PID}/status |cut -d: -f2|xargs)  #|xargs to trim whitespace!
+ PRCS_NAME=$(cat ${PROC_ROOT}/${PARENT_PROCESS}/comm 2>/dev/null) || \
+    PRCS_NAME=$(grep "^Name" ${PROC_ROOT}/${PID}/status |cut -d: -f2|xargs)  #|xargs to trim whitespace!
  #PRCS_PPID=$(ps -o ppid= -p ${PID})
  PRCS_PPID=$(ps -LA |awk -v pid=${PID} '$2==pid {print $1}')
  THRD_NAME=$(cat /proc/${PRCS_PPID}/task/${PID}/comm 2>/dev/null) || \
@@ -436,6 +1152,7 @@ main_wrapper()
  printf "[Pathname: %s ]\n" ${PRCS_PATHNAME}
  color_reset
  disp_fmt
+ timing_mark header
 
  LOC_LEN=0
  #decho "LOCATE_SPEC = ${LOCATE_SPEC}"
@@ -446,6 +1163,30 @@ main_wrapper()
    LOC_LEN=$(echo "${LOCATE_SPEC}" |cut -d, -f2)
  fi
 
+ #----------- --locate-batch : just build the segment tables and lookup into them
+ if [ ! -z "${LOCATE_BATCH_FILE}" ] ; then
+    [ ${SHOW_KERNELSEG} -eq 1 ] && populate_kernel_segment_mappings
+    [ ${SHOW_USERSPACE} -eq 1 ] && build_user_segtable ${gINFILE} /tmp/${name}/pmufinal
+    locate_batch ${LOCATE_BATCH_FILE}
+    return
+ fi
+
+ #----------- --jsonl : just build the segment tables and stream them out
+ if [ ! -z "${JSONL_FILE}" ] ; then
+    [ ${SHOW_KERNELSEG} -eq 1 ] && populate_kernel_segment_mappings
+    timing_mark kernel_segtable
+    [ ${SHOW_USERSPACE} -eq 1 ] && {
+       build_user_segtable ${gINFILE} /tmp/${name}/pmufinal
+       timing_mark user_segtable
+       smaps_per_vma ${PID} ${SMAPSFILE}
+       timing_mark smaps
+    }
+    jsonl_export ${JSONL_FILE}
+    timing_mark jsonl
+    echo "[i] memory map written to ${JSONL_FILE} (as JSON Lines)"
+    return
+ fi
+
  #----------- KERNEL-SPACE VAS calculation and drawing
  # Requires root (sudo)
  # Show kernelspace? Yes by default!
@@ -454,7 +1195,9 @@ main_wrapper()
     #get_machine_set_arch_config |tee -a ${LOG} || true
 
     populate_kernel_segment_mappings
+    timing_mark kernel_segtable
     graphit -k
+    timing_mark graphit_kernel
  else
    decho "Skipping kernel segment display..."
  fi
@@ -463,6 +1206,7 @@ main_wrapper()
  [ ${SHOW_USERSPACE} -eq 0 ] && {
    decho "Skipping userspace display..."
    footer_stats_etc
+   timing_mark stats
    return
  }
 
@@ -472,52 +1216,69 @@ main_wrapper()
  #printf "\n%s: Processing, pl wait ...\n" "${name}" 1>&2
 
  color_reset
- setup_usparse_top
-
- # Loop over the 'infile', populating the global 'n-d' array gArray
- local i=0 REC
- for REC in $(cat ${gINFILE})
- do 
-   decho "REC: $REC"
-   interpret_user_rec ${REC} ${i}
-   printf "=== %06d / %06d\r" ${i} $((${gFileLines}-1))
-   let i=i+1
- done 1>&2
-
-# By now, we've populated the gArr[] ;
-# Order is by descending va's, so check for and insert the last two entries:
-#  a conditional/possible sparse region and the NULL trap page
-
-# Setup the Sparse region just before the NULL trap page:
-#decho "prevseg_start_uva = ${prevseg_start_uva}"
-local gap_dec=$((prevseg_start_uva-PAGE_SIZE))
-local gap=$(printf "0x%llx" ${gap_dec})
-local prevseg_start_uva_hex=$(printf "%llx" ${prevseg_start_uva})
-
-if [ ${gap_dec} -gt ${PAGE_SIZE} ]; then
-  append_userspace_mapping "${SPARSE_ENTRY}" ${gap_dec} ${PAGE_SIZE} \
-     ${prevseg_start_uva_hex} "----" 0
-  inc_sparse ${gap}
+
+ # Build the userspace segment table - sparse regions, the NULL trap page and
+ # all - in one pass over the 'infile'; it's written out already ordered by
+ # descending va, so no sort(1) is required
+ build_user_segtable ${gINFILE} /tmp/${name}/pmufinal
+ timing_mark user_segtable
+ [ ${DEBUG} -eq 1 ] && {
+   decho "gRow = ${gRow}"
+   echo "user segment table:
+[segname,size,start_uva,end_uva,mode,offset]"
+   cat /tmp/${name}/pmufinal
+ }
+
+[ ${SHOW_RESIDENCY} -eq 1 ] && {
+   residency_scan ${PID} /tmp/${name}/pmufinal
+   timing_mark residency
+}
+
+# Per mapping memory cost (smaps); shown within the mapping and exported
+if [ ${SHOW_SMAPS} -eq 1 -o ! -z "${XMAP_FILE}" ] ; then
+   smaps_per_vma ${PID} ${SMAPSFILE}
+   [ ${SHOW_SMAPS} -eq 1 ] && {
+     awk -F"${gDELIM}" '$2 > 0 || $4 > 0 {
+	printf("%s,rss %d KB  pss %d KB  swap %d KB  thp %d KB  locked %d KB\n",
+		$1, $2, $3, $4, $5, $6) }' ${SMAPSFILE} >> ${ANNOTFILE}
+   }
+   timing_mark smaps
 fi
 
-# Setup the NULL trap page: the very last entry
-setup_nulltrap_page
+[ ${SHOW_NUMA} -eq 1 ] && {
+   numa_per_vma ${PID}
+   timing_mark numa
+}
+
+# --threads : name and annotate the thread stacks (and their guards)
+[ ${SHOW_THREADS} -eq 1 ] && {
+   thread_stacks ${PID} /tmp/${name}/pmufinal
+   timing_mark threads
+}
 
-[ ${DEBUG} -eq 1 ] && showArray 1
-total_size_userspc
+[ ! -z "${WSS_INTERVAL}" ] && {
+   wss_scan ${PID} ${WSS_INTERVAL} /tmp/${name}/pmufinal
+   timing_mark wss
+}
 
-##################
-# Get all the user mapping data into a file:
-# Reverse sort by 4th field, the hexadecimal end va; simple ASCII sort works
-# because numbers 0-9a-f are anyway in alphabetical order
-showArray 0 > /tmp/${name}/pmu
-sort -f -t"," -k4 -r /tmp/${name}/pmu > /tmp/${name}/pmufinal
-##################
+# --collapse : summarize runs of like mappings (the full detail's kept)
+[ ${SHOW_COLLAPSE} -eq 1 ] && {
+   collapse_user_segtable /tmp/${name}/pmufinal /tmp/${name}/pmucollapsed
+   timing_mark collapse
+}
 
 # draw it!
 [ ${SHOW_USERSPACE} -eq 1 ] && graphit -u
+timing_mark graphit_user
+# --numa : the per node summary
+[ ${SHOW_NUMA} -eq 1 -a -s ${NUMASTATS} ] && cat ${NUMASTATS}
+# --wss : the summary
+[ ! -z "${WSS_INTERVAL}" -a -s ${WSSSTATS} ] && cat ${WSSSTATS}
+# --threads : the stack totals
+[ ${SHOW_THREADS} -eq 1 -a -s ${THREADSTATS} ] && cat ${THREADSTATS}
 
 footer_stats_etc
+timing_mark stats
 } # end main_wrapper()
 
 # stats()
@@ -538,18 +1299,17 @@ fi
    printf "\nTotal User VAS (Virtual Address Space):\n"
    largenum_display ${uvsize}
 
+   # (before 'name' is the process's)
+   [ ${SHOW_USERSPACE} -eq 1 ] && vas_frag /tmp/${name}/pmufinal ${FRAGFILE}
    local PID=$1
    local name="$2"
    local numvmas=0
-   #local numvmas=$(sudo wc -l /proc/${PID}/maps |awk '{print $1}')
-   wc -l /proc/${PID}/maps >/dev/null 2>&1 && local numvmas=$(wc -l /proc/${PID}/maps |awk '{print $1}') || \
-     echo "*Whoops, getting num VMAs requires you to run procmap as root*"
-   #[ ${gFileLines} -ne ${numvmas} ] && printf " [!] Warning! # VMAs does not match /proc/${PID}/maps\n"
-   # The [vsyscall] VMA shows up but the NULL trap doesn't
-   [[ ${numvmas} -ne 0 && ${SHOW_VSYSCALL_PAGE} -eq 1 ]] && let numvmas=numvmas+1  # for the NULL trap page
+   # the VMA count's vas_frag()'s, so that it's the same everywhere
+   [ -s ${FRAGFILE} ] && numvmas=$(awk -F= '$1 == "nr_vmas" { print $2 }' ${FRAGFILE})
+   [ ${SHOW_USERSPACE} -eq 1 -a ${numvmas} -eq 0 ] && echo "*Whoops, getting num VMAs requires you to run procmap as root*"
 
    #--- Total reported memory (RAM) on the system
-   local totalram_kb=$(grep "^MemTotal" /proc/meminfo |cut -d: -f2|awk '{print $1}')
+   local totalram_kb=$(grep "^MemTotal" ${PROC_ROOT}/meminfo |cut -d: -f2|awk '{print $1}')
    local totalram=$(bc <<< "${totalram_kb}*1024")
    printf "\nTotal reported memory (RAM) on this system:\n"
    largenum_display ${totalram}
@@ -568,30 +1328,54 @@ fi
    # Valid regions (segments) total size
    printf "\nTotal User VAS that's valid (mapped) memory:\n"
    largenum_display ${gTotalSegSize} ${USER_VAS_SIZE}
+
+   # Fragmentation and mmap headroom (see vas_frag())
+   awk -F= -v sparse_show=${SPARSE_SHOW} "${AWK_HEXLIB}"'
+   { v[$1] = $2 ; if ($1 ~ /^hist_/) hk[++nh] = $1 }
+   END {
+     printf("\nFragmentation:\n %d VMAs", v["nr_vmas"])
+     if (v["max_map_count"] > 0)
+	printf(" of vm.max_map_count %d: headroom %d VMAs (%.1f%% used)", v["max_map_count"],
+	       v["max_map_count"] - v["nr_vmas"], v["nr_vmas"]*100/v["max_map_count"])
+     printf("\n %d adjacent like mappings (same perms; anonymous, or same file and not COW-touched) not merged\n",
+	    v["nr_mergeable"])
+     if (sparse_show != 1) exit
+     printf(" %d holes (sparse regions), total %s; largest %s at 0x%s\n", v["nr_holes"],
+	    hsz(v["hole_total"]), hsz(v["largest_hole"]), v["largest_hole_start"])
+     printf(" largest hole between the heap and the top of the mmap area: %s at 0x%s\n",
+	    hsz(v["mmap_hole"]), v["mmap_hole_start"])
+     printf(" hole sizes : ")
+     for (i = 1; i <= nh; i++) { b = substr(hk[i], 6) ; printf("%10s", (b == "inf") ? "more" : "< " b) }
+     printf("\n   # holes  : ")
+     for (i = 1; i <= nh; i++) { split(v[hk[i]], c, ",") ; printf("%10d", c[1]) }
+     printf("\n   size     : ")
+     for (i = 1; i <= nh; i++) { split(v[hk[i]], c, ",") ; printf("%10s", c[1] ? hsz(c[2]) : "-") }
+     printf("\n")
+   }' ${FRAGFILE}
    printf "\n===\n"
 
-   # Show ps and smem stats only if it's a process and not a worker/child thread of some process
+   # Show the memory usage stats only if it's a process and not a worker/child thread of some process
    [[ ${ITS_A_THREAD} -eq 1 ]] && {
 	echo ; return
    }
 
    printf "\nMemory Usage stats for process PID %d:%s\n" ${PID} ${name}
-   printf "Via ps(1):\n"
-# ps aux|head -n1
-# USER       PID %CPU %MEM    VSZ   RSS TTY      STAT START   TIME COMMAND
-   ps aux |awk -v pid=${PID} '$2==pid {printf(" %%MEM=%u   VSZ=%lu KB   \
-RSS=%lu KB\n", $4,$5,$6)}'
-
-  which smem >/dev/null 2>&1 && {
-   # This requires root for processes you don't own
-   [[ ${PROCESS_OWNER} -eq 1 ]] && {
-     printf "Via smem(8) [might take a while, pl wait ...] :\n"
-# smem|head -n1
-# PID User     Command                         Swap      USS      PSS      RSS 
-     smem |awk -v pid=${PID} '$1==pid {printf(" swap=%u   USS=%lu KB   \
-PSS=%lu KB   RSS=%lu KB\n", $4,$5,$6,$7)}' || echo "OOPS, requires root"
-   } || vecho "smem(8) requires root, skipping..."
-  }
+   # Via smaps_rollup (4.14 onward) - the kernel sums it up for us, cheaply;
+   # else, sum up the per VMA smaps ourselves (in one pass)
+   local rollup=${PROC_ROOT}/${PID}/smaps_rollup
+   [ -r ${rollup} ] || rollup=${PROC_ROOT}/${PID}/smaps
+   awk -v totalram_kb=${totalram_kb} -v vsz_kb=$(awk '$1=="VmSize:" {print $2}' ${PROC_ROOT}/${PID}/status) '
+   $1 ~ /^(Rss|Pss|Pss_Anon|Pss_File|Pss_Shmem|Swap|SwapPss|AnonHugePages|Locked):$/ {
+	sub(/:$/, "", $1) ; v[$1] += $2
+   }
+   END {
+	if (!("Rss" in v)) { print " OOPS, requires root" ; exit }
+	printf(" %%MEM=%.1f   VSZ=%lu KB   RSS=%lu KB   PSS=%lu KB", v["Rss"]*100/totalram_kb, vsz_kb, v["Rss"], v["Pss"])
+	if ("Pss_Anon" in v)
+	   printf(" (anon %lu KB, file %lu KB, shmem %lu KB)", v["Pss_Anon"], v["Pss_File"], v["Pss_Shmem"])
+	printf("\n Swap=%lu KB   SwapPss=%lu KB   AnonHugePages=%lu KB   Locked=%lu KB\n",
+		v["Swap"], v["SwapPss"], v["AnonHugePages"], v["Locked"])
+   }' ${rollup} 2>/dev/null || echo " OOPS, requires root"
  #else
  # echo
  fi       # if ${SHOW_USERSPACE} -eq 1
@@ -22,10 +22,138 @@ source ${PFX}/.scratchfile
 
 LOCATED_REGION_ENTRY="<--LOCATED-->"
 
+# Common awk(1) helper routines - hex <-> decimal, va arithmetic, human-readable
+# sizes - for use by all the scripts, like this:
+#  awk [...] "${AWK_HEXLIB}"' <the awk program> '
+# The awk could well be mawk, so no strtonum() and no bitwise ops; also, it's
+# printf("%x") clamps to 32-bit. So we do hex <-> decimal ourselves; awk numbers
+# are double-precision, exact up to 2^53, which is fine for any VA we handle.
+export AWK_HEXLIB='
+function hex2dec(h,   i, n) {
+  n = 0 ; h = tolower(h) ; sub(/^0x/, "", h)
+  for (i = 1; i <= length(h); i++)
+     n = n*16 + index("0123456789abcdef", substr(h, i, 1)) - 1
+  return n
+}
+function dec2hex(n,   s, d) {
+  if (n <= 0) return "0"
+  s = ""
+  while (n > 0) { d = n % 16 ; s = substr("0123456789abcdef", d+1, 1) s ; n = (n-d)/16 }
+  return s
+}
+# A va as 16 hex digits (lowercase, no 0x); so va(s) compare as strings
+function pad16(h) {
+  h = tolower(h) ; sub(/^0x/, "", h)
+  return substr("0000000000000000", 1, 16-length(h)) h
+}
+# a - b, exact, for (16 hex digit) va(s) with a >= b and a - b < 2^53
+function hexdiff(a, b) {
+  return (hex2dec(substr(a, 1, 8)) - hex2dec(substr(b, 1, 8))) * 4294967296 + \
+	  hex2dec(substr(a, 9)) - hex2dec(substr(b, 9))
+}
+# A size (in bytes; may be negative, f.e. a delta) in human-readable form
+function hsz(n,   sg) {
+  sg = "" ; if (n < 0) { sg = "-" ; n = -n }
+  if (n < 1048576) return sprintf("%s%.0f KB", sg, n/1024)
+  if (n < 1073741824) return sprintf("%s%.2f MB", sg, n/1048576)
+  if (n < 1099511627776) return sprintf("%s%.2f GB", sg, n/1073741824)
+  return sprintf("%s%.2f TB", sg, n/1099511627776)
+}
+'
+
+# timing_start(), timing_mark()
+# Per phase timing and subprocess counts; active only when TIMING_FILE is set
+# (by --timing, or f.e. by the benchmark, test/benchmark.sh). Each mark appends
+#   phase,usecs,#processes
+# to ${TIMING_FILE}: the (absolute) time and the system's count of processes
+# created so far (the 'processes' line of /proc/stat) - so the phases carry on
+# across our scripts (procmap -> do_vgraph.sh) and the report - see
+# timing_report() - just takes the differences. The time's from bash's
+# EPOCHREALTIME, so marking needs no subprocess (on bash < 5, falls back to
+# date(1)); the process count is system-wide, so it's exact on an idle box.
+# Parameters (timing_mark):
+#   $1 = name of the phase that just completed
+timing_now()
+{
+ if [ ! -z "${EPOCHREALTIME:-}" ] ; then
+    TIMING_NOW=${EPOCHREALTIME/./}
+ else
+    TIMING_NOW=$(date +%s%6N)
+ fi
+ local k v
+ TIMING_PROCS=0
+ while IFS=" " read -r k v ; do
+   [ "${k}" = "processes" ] && { TIMING_PROCS=${v%% *} ; break ; }
+ done < /proc/stat
+}
+timing_start()
+{
+ [ -z "${TIMING_FILE:-}" ] && return 0
+ [ -s ${TIMING_FILE} ] && return 0  # already started (by procmap)
+ timing_now
+ echo "start,${TIMING_NOW},${TIMING_PROCS}" > ${TIMING_FILE}
+}
+timing_mark()
+{
+ [ -z "${TIMING_FILE:-}" ] && return 0
+ timing_now
+ echo "$1,${TIMING_NOW},${TIMING_PROCS}" >> ${TIMING_FILE}
+}
+
+# timing_report()
+# Show the per phase time (ms, and % of the total) and # of subprocesses
+# spawned (see timing_mark() above), as a table or as JSON.
+# Parameters:
+#   $1 = the timing file
+#   $2 = OPTIONAL: write JSON to this file (- for stdout) instead of the table
+timing_report()
+{
+[ ! -s $1 ] && return
+awk -F, -v json="${2:-}" '
+NR == 1 { t0 = pt = $2 ; p0 = pp = $3 ; next }
+{ n++ ; ph[n] = $1 ; ms[n] = ($2 - pt)/1000 ; np[n] = $3 - pp ; pt = $2 ; pp = $3 }
+END {
+  tot = (pt - t0)/1000 ; ntot = pp - p0
+  if (tot <= 0) tot = 1
+  if (json != "") {
+    out = (json == "-") ? "/dev/stdout" : json
+    printf("{\n  \"total_ms\": %.3f,\n  \"subprocesses\": %d,\n  \"phases\": [\n", tot, ntot) > out
+    for (i = 1; i <= n; i++)
+      printf("    { \"phase\": \"%s\", \"ms\": %.3f, \"subprocesses\": %d }%s\n", ph[i], ms[i], \
+	   np[i], (i < n) ? "," : "") > out
+    printf("  ]\n}\n") > out
+    exit
+  }
+  printf("\n--- Timing (per phase) ---\n")
+  printf("%-18s %12s %7s %8s\n", "phase", "ms", "%", "#procs")
+  for (i = 1; i <= n; i++)
+    printf("%-18s %12.3f %6.1f%% %8d\n", ph[i], ms[i], ms[i]*100/tot, np[i])
+  printf("%-18s %12.3f %6.1f%% %8d\n", "total", tot, 100, ntot)
+  printf("(#procs: processes created system-wide during the phase)\n")
+}' $1
+} # end timing_report()
+
+# hexpad16()
+# Set the variable named by $1 to the hex number passed - with or without the
+# 0x prefix - as 16 lowercase hex digits, zero-padded (w/o the 0x); such strings
+# compare just like the numbers do. No subprocess: it's called within loops.
+# Parameters:
+#   $1 = name of the variable to set
+#   $2 = hex number
+hexpad16()
+{
+ local h=${2#0x}
+ local zeros=0000000000000000
+ h=${h,,}
+ [ ${#h} -lt 16 ] && h=${zeros:0:16-${#h}}${h}
+ printf -v "$1" "%s" "${h}"
+}
+
 # locate_region()
 # Insert a 'locate region'? (passed via -l)
+# (For userspace, this is now done within build_user_segtable() itself.)
 # Parameters:
-#   $1 = -u|-k; -u => from userspace, -k => from kernel-space
+#   $1 = -k => from kernel-space
 #   $2 = start virtual addr of the region to check for intersection (hex)
 #   $3 =   end virtual addr of the region to check for intersection (hex)
 locate_region()
@@ -35,46 +163,1203 @@ locate_region()
  [ "${lr_end_va:0:2}" != "0x" ] && lr_end_va=0x$3
 #set -x
 
-# TODO / RELOOK
-# Error:
-#/home/kaiwan/gitLinux_repos/procmap/lib_procmap.sh: line 32: printf: 558ba488c000: invalid number
-#/home/kaiwan/gitLinux_repos/procmap/lib_procmap.sh: line 32: printf: 558ba488b000: invalid number
- local start_va_dec=$(printf "%llu" ${lr_start_va} 2>/dev/null)
- local   end_va_dec=$(printf "%llu" ${lr_end_va} 2>/dev/null)
-
- #local start_va_dec=$(printf "%llu" 0x${2})
- #local   end_va_dec=$(printf "%llu" 0x${3})
-#set +x
-
- if (( $(echo "${LOC_STARTADDR_DEC} >= ${start_va_dec}" |bc -l) )) ; then
-    if (( $(echo "${LOC_STARTADDR_DEC} <= ${end_va_dec}" |bc -l) )) ; then
+ # Kernel va's don't fit in bash's (signed) 64-bit arithmetic; so, we compare
+ # them as (zero-padded, same length) hex strings - no bc(1) forks
+ local loc_va lr_start lr_end
+ hexpad16 loc_va ${LOC_STARTADDR}
+ hexpad16 lr_start ${lr_start_va}
+ hexpad16 lr_end ${lr_end_va}
+ if [[ ! "${loc_va}" < "${lr_start}" ]] ; then
+    if [[ ! "${loc_va}" > "${lr_end}" ]] ; then
 	   decho " <-------- located :: start = ${LOC_STARTADDR} of length ${LOC_LEN} KB -------->"
 
 	   local loc_len_bytes=$((LOC_LEN*1024))
-	   local loc_end_va_dec=$(bc <<< "${LOC_STARTADDR_DEC}+${loc_len_bytes}")
-	   LOC_END_VA=0x$(printf "%llx" ${loc_end_va_dec})
+	   # (bash's printf %llx shows an overflowed, -ve, sum correctly as unsigned)
+	   LOC_END_VA=0x$(printf "%llx" $((LOC_STARTADDR+loc_len_bytes)))
 
 	   if [ "$1" = "-k" ]; then
          do_append_kernel_mapping "${LOCATED_REGION_ENTRY}" "${loc_len_bytes}" ${LOC_STARTADDR} \
 	        ${LOC_END_VA} "..."
-	   elif [ "$1" = "-u" ]; then
-         do_append_userspace_mapping "${LOCATED_REGION_ENTRY}" "${loc_len_bytes}" ${LOC_STARTADDR} \
-	        ${LOC_END_VA} "..." 0
        fi
     fi
  fi
 } # end locate_region()
 
-# inc_sparse()
+# symtab_cache()
+# Ensure that the (cached) symbol table of the ELF image passed is present;
+# it's generated via readelf(1) and nm(1) just once for a given image and
+# thereafter reused (across runs too), as long as the image's size, mtime
+# and inode remain the same. Echoes the pathname of the cache file.
+# Cache file format:
+#  L p_offset p_vaddr p_filesz      ; one line per PT_LOAD segment (hex)
+#  S value name                     ; one line per symbol, sorted by value (hex)
+# Parameters:
+#   $1 = pathname of the ELF image
+symtab_cache()
+{
+ local img=$1 key cache
+ key=$(stat -L -c "%s.%Y.%i" "${img}" 2>/dev/null) || return 1
+ cache=${SYMCACHE_DIR}/$(echo "${img}" | tr '/' '%').${key}
+ [ -s "${cache}" ] && { echo "${cache}" ; return 0 ; }
+
+ mkdir -p ${SYMCACHE_DIR} 2>/dev/null || return 1
+ rm -f ${SYMCACHE_DIR}/$(echo "${img}" | tr '/' '%').* 2>/dev/null  # stale ones
+ {
+  readelf -lW "${img}" 2>/dev/null | awk '$1 == "LOAD" { print "L", $2, $3, $5 }'
+  # Prefer the full (static) symbol table; if it's been stripped, use the dynamic one
+  { nm -n --defined-only "${img}" 2>/dev/null | grep -q . && \
+      nm -n --defined-only "${img}" 2>/dev/null || \
+      nm -D -n --defined-only "${img}" 2>/dev/null ; } | \
+   awk 'NF == 3 && $2 ~ /^[TtWwiVv]$/ && $1 !~ /^0+$/ { print "S", $1, $3 }'
+ } > ${cache}.tmp && mv ${cache}.tmp ${cache}
+ echo "${cache}"
+}
+
+# locate_batch()
+# The --locate-batch=FILE option: resolve many addresses, in one go. For each
+# address (in hex, one per line; the first field of the line) read from the
+# file, we show which segment (mapping) it's within, it's offset into the
+# segment and into the backing file, the segment's permissions and, for ELF
+# images, the (nearest preceding) symbol: sym+offset.
+# The user and kernel segment tables are merged into one interval index
+# (sorted by start va) and each address is found via a binary search; so
+# thousands of addresses (f.e. from a crash dump or perf samples) are
+# resolved in O(log n) each. Addresses are compared as zero-padded hex strings
+# as kernel va's aren't exact as awk (double-precision) numbers.
+# Parameters:
+#   $1 = the file containing the addresses
+locate_batch()
+{
+local idx=/tmp/${name}/loc.idx res=/tmp/${name}/loc.res
+local imgs=/tmp/${name}/loc.imgs img cache
+
+# The interval index: start,end,name,mode,offset ; all va's 16 hex digits
+cat /tmp/${name}/pmkfinal /tmp/${name}/pmufinal 2>/dev/null | \
+ awk -F"${gDELIM}" -v OFS="${gDELIM}" -v loc="${LOCATED_REGION_ENTRY}" "${AWK_HEXLIB}"'
+ NF >= 5 && $1 != loc { print pad16($3), pad16($4), $1, $5, (NF >= 6 ? $6 : 0) }' | \
+ sort -t"${gDELIM}" -k1,1 > ${idx}
+
+# Pass 1: lookup the segment; output:
+#  addr,name,mode,off_in_seg,file_off
+awk -F"${gDELIM}" -v OFS="${gDELIM}" -v idx=${idx} "${AWK_HEXLIB}"'
+BEGIN {
+  n = 0
+  while ((getline ln < idx) > 0) {
+     split(ln, f, ",")
+     st[n] = f[1] ; en[n] = f[2] ; nm[n] = f[3] ; md[n] = f[4] ; of[n] = f[5] ; n++
+  }
+  FS = " "
+}
+/^[ \t]*(#|$)/ { next }
+{
+  a = $1
+  if (a !~ /^(0x|0X)?[0-9a-fA-F]+$/) { bad++ ; next }
+  a = pad16(a)
+  # binary search: the last segment with start <= a
+  lo = 0 ; hi = n-1 ; i = -1
+  while (lo <= hi) {
+     mid = int((lo+hi)/2)
+     if (st[mid] <= a) { i = mid ; lo = mid+1 } else hi = mid-1
+  }
+  if (i < 0 || a >= en[i]) {
+     print "0x" a, "<unmapped>", "-", "-", "-"
+     next
+  }
+  d = hexdiff(a, st[i])
+  fo = "-"
+  if (substr(nm[i], 1, 1) == "/")
+     fo = sprintf("0x%s", dec2hex(d + hex2dec(of[i])))
+  print "0x" a, nm[i], md[i], sprintf("0x%s", dec2hex(d)), fo
+}
+END { if (bad) printf("%d lines skipped (not a hex address)\n", bad) > "/dev/stderr" }' ${1} > ${res}
+
+# Build (or reuse) the symbol table cache of each ELF image involved
+awk -F"${gDELIM}" '$5 != "-" { print $2 }' ${res} | sort -u > ${imgs}
+local symfiles=""
+if which nm >/dev/null 2>&1 && which readelf >/dev/null 2>&1 ; then
+   while IFS= read -r img
+   do
+      [ -r "${img}" ] || continue
+      cache=$(symtab_cache "${img}") || continue
+      symfiles="${symfiles}${img}${gDELIM}${cache}"$'\n'
+   done < ${imgs}
+fi
+
+# Pass 2: the symbols; (lazily) load each image's symbol table, binary search
+printf "# address,segment,perms,offset-in-segment,offset-in-file,symbol\n"
+awk -F"${gDELIM}" -v OFS="${gDELIM}" -v symfiles="${symfiles}" "${AWK_HEXLIB}"'
+function load(img,   c, ln, f, ns, nl) {
+  loaded[img] = 1
+  if (!(img in cachef)) return
+  c = cachef[img] ; ns = nl = 0
+  while ((getline ln < c) > 0) {
+     split(ln, f, " ")
+     if (f[1] == "L") {
+        lo_[img, nl] = hex2dec(f[2]) ; lv_[img, nl] = hex2dec(f[3]) ; lf_[img, nl] = hex2dec(f[4]) ; nl++
+     } else {
+        sv[img, ns] = hex2dec(f[2]) ; sn[img, ns] = f[3] ; ns++
+     }
+  }
+  close(c)
+  nload[img] = nl ; nsym[img] = ns
+}
+function symbolize(img, fo,   i, va, lo, hi, mid, k) {
+  if (!(img in loaded)) load(img)
+  # file offset -> (ELF) virtual address, via the PT_LOAD that contains it
+  va = -1
+  for (i = 0; i < nload[img]; i++)
+     if (fo >= lo_[img, i] && fo < lo_[img, i] + lf_[img, i]) {
+        va = fo - lo_[img, i] + lv_[img, i] ; break
+     }
+  if (va < 0 || !nsym[img]) return ""
+  lo = 0 ; hi = nsym[img]-1 ; k = -1
+  while (lo <= hi) {
+     mid = int((lo+hi)/2)
+     if (sv[img, mid] <= va) { k = mid ; lo = mid+1 } else hi = mid-1
+  }
+  if (k < 0) return ""
+  return sprintf("%s+0x%s", sn[img, k], dec2hex(va - sv[img, k]))
+}
+BEGIN {
+  n = split(symfiles, sf, "\n")
+  for (i = 1; i <= n; i++) {
+     if (sf[i] == "") continue
+     j = index(sf[i], ",")
+     cachef[substr(sf[i], 1, j-1)] = substr(sf[i], j+1)
+  }
+}
+{
+  sym = ""
+  if ($5 != "-") sym = symbolize($2, hex2dec($5))
+  print $0, sym
+}' ${res}
+[ ${DEBUG} -eq 0 ] && rm -f ${idx} ${res} ${imgs} || true
+} # end locate_batch()
+
+# jsonl_export()
+# --jsonl=FILE : write the memory map as JSON Lines - one JSON object per line -
+# for monitoring agents and the like (no terminal output to scrape). Records,
+# in this order:
+#  {"type":"process", pid, comm, exe, arch, page_size, time}
+#  {"type":"segment", space (kernel|user), kind (mapping|sparse|nulltrap),
+#   name, start, end (hex strings), size, perms[, offset, and - for user
+#   mappings, from smaps - rss_kb, pss_kb, swap_kb, thp_kb, locked_kb]}
+#   ; one per segment, kernel then user, in descending va order
+#  {"type":"stats", kernel_vas_size, user_vas_size, nr_vmas, mapped_size,
+#   nr_sparse, sparse_size}
+#  {"type":"frag", nr_vmas, max_map_count, nr_mergeable, nr_holes, hole_total,
+#   largest_hole, largest_hole_start, mmap_hole, mmap_hole_start,
+#   hole_hist: [{"lt", count, size}, ...]}   ; see vas_frag(); user VAS only
+# It's a single awk pass over the (already built) segment tables; the smaps
+# details are merged in as we go (both are in va order), so it runs in
+# constant memory however many mappings there are.
+# Parameters:
+#   $1 = the JSONL output file
+jsonl_export()
+{
+local out=$1 now nvmas=0 kvsz uvsz
+printf -v now '%(%Y-%m-%dT%H:%M:%S%z)T' -1
+kvsz=$(printf "%d" ${KERNEL_VAS_SIZE} 2>/dev/null) || kvsz=0
+uvsz=$(printf "%d" ${USER_VAS_SIZE} 2>/dev/null) || uvsz=0
+[ -s /tmp/${name}/pmufinal ] && {
+   vas_frag /tmp/${name}/pmufinal ${FRAGFILE}
+   nvmas=$(awk -F= '$1 == "nr_vmas" { print $2 }' ${FRAGFILE})
+}
+
+cat /tmp/${name}/pmkfinal /tmp/${name}/pmufinal 2>/dev/null | \
+ awk -F"${gDELIM}" -v nkern=$(cat /tmp/${name}/pmkfinal 2>/dev/null | wc -l) \
+	-v smaps=${SMAPSFILE} -v loc="${LOCATED_REGION_ENTRY}" -v nulltrap="${NULLTRAP_STR}" \
+	-v pid=${PID} -v comm="${PRCS_NAME}" -v exe="${PRCS_PATHNAME}" -v arch="${ARCH}" \
+	-v pgsz=${PAGE_SIZE} -v now="${now}" -v kvsz=${kvsz} -v uvsz=${uvsz} \
+	-v nvmas=${nvmas} -v nsparse=${gNumSparse:-0} -v sparsesz=${gTotalSparseSize:-0} \
+	-v mappedsz=${gTotalSegSize:-0} -v fragf=${FRAGFILE} "${AWK_HEXLIB}"'
+function jstr(s) {
+  gsub(/\\/, "\\\\", s) ; gsub(/"/, "\\\"", s) ; gsub(/\t/, "\\t", s)
+  gsub(/[\001-\037]/, "?", s)
+  return "\"" s "\""
+}
+# Advance the (descending va ordered) smaps stream to the record for va h
+function smaps_for(h,   v) {
+  v = hex2dec(h)
+  while (sm_ok && hex2dec(sm[1]) > v)
+    sm_ok = ((smcmd | getline ln) > 0) && split(ln, sm, ",")
+  return (sm_ok && sm[1] == h)
+}
+BEGIN {
+  printf("{\"type\":\"process\",\"pid\":%d,\"comm\":%s,\"exe\":%s,\"arch\":%s,\"page_size\":%d,\"time\":%s}\n",
+	 pid, jstr(comm), jstr(exe), jstr(arch), pgsz, jstr(now))
+  smcmd = "tac " smaps " 2>/dev/null"
+  sm_ok = ((smcmd | getline ln) > 0) && split(ln, sm, ",")
+}
+$1 == loc || NF < 5 { next }
+{
+  space = (NR <= nkern) ? "kernel" : "user"
+  kind = "mapping"
+  if ($1 == nulltrap) kind = "nulltrap"
+  else if (substr($1, 1, 4) == "<...") kind = "sparse"
+  printf("{\"type\":\"segment\",\"space\":\"%s\",\"kind\":\"%s\",\"name\":%s,\"start\":\"0x%s\",\"end\":\"0x%s\",\"size\":%s,\"perms\":%s",
+	 space, kind, jstr($1), $3, $4, $2, jstr($5))
+  if (space == "user" && kind == "mapping") {
+     printf(",\"offset\":\"0x%s\"", $6)
+     if (smaps_for($3))
+        printf(",\"rss_kb\":%d,\"pss_kb\":%d,\"swap_kb\":%d,\"thp_kb\":%d,\"locked_kb\":%d",
+	       sm[2], sm[3], sm[4], sm[5], sm[6])
+  }
+  printf("}\n")
+}
+END {
+  close(smcmd)
+  printf("{\"type\":\"stats\",\"kernel_vas_size\":%s,\"user_vas_size\":%s,\"nr_vmas\":%d,\"mapped_size\":%s,\"nr_sparse\":%d,\"sparse_size\":%s}\n",
+	 kvsz, uvsz, nvmas, mappedsz, nsparse, sparsesz)
+  if (nvmas == 0) exit
+  rec = "" ; hist = ""
+  while ((getline ln < fragf) > 0) {
+     i = index(ln, "=") ; k = substr(ln, 1, i-1) ; v = substr(ln, i+1)
+     if (k ~ /^hist_/) {
+        split(v, c, ",")
+        hist = hist sprintf("%s{\"lt\":%s,\"count\":%d,\"size\":%s}", (hist == "") ? "" : ",",
+			    jstr(substr(k, 6)), c[1], c[2])
+     } else if (k ~ /_start$/)
+        rec = rec sprintf(",\"%s\":\"0x%s\"", k, v)
+     else
+        rec = rec sprintf(",\"%s\":%s", k, v)
+  }
+  close(fragf)
+  printf("{\"type\":\"frag\"%s,\"hole_hist\":[%s]}\n", rec, hist)
+}' > ${out}
+} # end jsonl_export()
+
+# vas_frag()
+# Fragmentation of the userspace VAS - what makes mmap() fail long before RAM
+# runs out (f.e. on 32-bit targets), along with vm.max_map_count - from the
+# sparse regions of the (already built) segment table, in one awk pass:
+#  - the distribution of the hole (sparse region) sizes, in buckets
+#  - the largest hole and the largest one in the mmap area: between the top
+#    of the heap (else, the lowest mapping) and the top of the mmap area (the
+#    highest mapping below the stack; it approximates mmap_base)
+#  - the # of VMAs vs vm.max_map_count; the one VMA count shown (by stats()
+#    and the --jsonl stats and frag records alike): the maps lines, less the
+#    [vsyscall] (it isn't in the process's mm; nor counted against the limit)
+#  - the # of adjacent mappings that look mergeable (same permissions, and
+#    both anonymous, or the same file at contiguous offsets and neither one
+#    COW-touched) but weren't merged by the kernel (f.e. a differing anon_vma,
+#    mempolicy or userfaultfd). A private file mapping with pages written to -
+#    f.e. the RELRO part of a library, mprotect()ed to r--p - has an anon_vma
+#    its neighbour hasn't, so the kernel can't merge them; we tell from the
+#    pagemap (of just those mappings): a present page that isn't a file page
+#    is a private copy. Without the pagemap (not ours and not root, or not
+#    live) file-backed pairs aren't counted.
+# Written to the file passed as key=value lines (all sizes in bytes, vas in
+# hex), the format shown by stats() and exported (see jsonl_export()):
+#  nr_vmas, max_map_count (0 if unknown), nr_mergeable, nr_holes, hole_total,
+#  largest_hole, largest_hole_start, mmap_hole, mmap_hole_start,
+#  hist_<bound>=count,bytes  ; holes < bound, for 64K 1M 16M 256M 4G 64G 1T inf
+# Parameters:
+#   $1 = the userspace segment table (CSV, 6 fields/record)
+#   $2 = output file
+vas_frag()
+{
+local mmc=0 cand=/tmp/${name}/frag.cand cow=/tmp/${name}/frag.cow cowok=0
+[ "${PROC_ROOT}" = "/proc" ] && { read -r mmc < /proc/sys/vm/max_map_count || mmc=0 ; }
+
+# The file-backed candidates ('start_hex pagemap_offset #pages'; see
+# pagemap_list()), and which of them are COW-touched
+awk -F"${gDELIM}" -v pgsz=${PAGE_SIZE} -v nulltrap="${NULLTRAP_STR}" -v loc="${LOCATED_REGION_ENTRY}" \
+    "${AWK_HEXLIB}"'
+function out(s, e) {
+  if (s == last) return
+  printf("%s %.0f %.0f\n", s, hex2dec(s)/pgsz*8, (hex2dec(e) - hex2dec(s))/pgsz)
+  last = s
+}
+$1 == loc || $1 == nulltrap || NF < 6 { next }
+{
+  if (prev != "" && substr($1, 1, 1) == "/" && $4 == p[3] && $1 == p[1] && $5 == p[5] &&
+      hex2dec(p[6]) == hex2dec($6) + $2) {
+    out(p[3], p[4]) ; out($3, $4)
+  }
+  prev = $0 ; split($0, p, FS)
+}' ${1} | sort -n -k2,2 > ${cand}
+: > ${cow}
+if [ -s ${cand} -a "${PROC_ROOT}" = "/proc" ] && \
+   dd if=/proc/${PID}/pagemap bs=8 count=1 of=/dev/null status=none 2>/dev/null ; then
+   cowok=1
+   # present, and not a file page (bit 61): a private copy
+   pagemap_read ${PID} ${cand} | awk -v list=${cand} "${AWK_HEXLIB}${AWK_PAGEMAP}"'
+   function pm_seg(v, p, n, t, a) { if (t ~ / [89cd]/) cow[v] = 1 }
+   function pm_run(v, p, n, ent) { if (ent ~ / [89cd]/) cow[v] = 1 }
+   function pm_pfns(v, pfn, cnt) { }
+   END { for (v in cow) print vs[v] }' > ${cow}
+fi
+
+awk -F"${gDELIM}" -v mmc=${mmc} -v sparse_entry="${SPARSE_ENTRY}" -v maps=${PROC_ROOT}/${PID}/maps \
+    -v nulltrap="${NULLTRAP_STR}" -v loc="${LOCATED_REGION_ENTRY}" -v cowf=${cow} -v cowok=${cowok} \
+    "${AWK_HEXLIB}"'
+BEGIN {
+  while ((getline ln < cowf) > 0) cow[ln] = 1
+  close(cowf)
+  nb = split("64K 1M 16M 256M 4G 64G 1T inf", bname, " ")
+  for (i = 1; i < nb; i++) bound[i] = 2^(12 + 4*i)
+}
+$1 == loc || $1 == nulltrap || NF < 6 { next }
+$1 == sparse_entry {
+  sz = $2 + 0 ; nholes++ ; htot += sz
+  for (i = 1; i < nb && sz >= bound[i]; i++) ;
+  hcnt[i]++ ; hbytes[i] += sz
+  if (sz > big) { big = sz ; big_at = $3 }
+  pend = sz ; pend_at = $3
+  prev = "" ; next
+}
+$1 == "[vsyscall]" { next }
+{
+  nvmas++
+  # The mmap area: from the top down to the heap (the table is in descending
+  # va order); a hole counts once there is a mapping below it (so, w/o a
+  # [heap], the hole below the lowest mapping does not)
+  if (in_mmap && pend > mbig) { mbig = pend ; mbig_at = pend_at }
+  pend = 0
+  if ($1 == "[stack]") stack_seen = 1
+  else if (stack_seen && !mmap_done) in_mmap = 1
+  if ($1 == "[heap]") { in_mmap = 0 ; mmap_done = 1 }
+  # adjacent (this one ends where the previous, higher, one starts) and alike?
+  if (prev != "" && $4 == p[3] && $1 == p[1] && $5 == p[5]) {
+    if (substr($1, 1, 1) != "/")
+      nmerge++
+    else if (cowok && hex2dec(p[6]) == hex2dec($6) + $2 && !($3 in cow) && !(p[3] in cow))
+      nmerge++
+  }
+  prev = $0 ; split($0, p, FS)
+}
+END {
+  # (the table can be --collapse d, or trimmed; the maps can not)
+  while ((getline ln < maps) > 0)
+    if (ln !~ / \[vsyscall\]$/) nmaps++
+  close(maps)
+  if (nmaps) nvmas = nmaps
+  printf("nr_vmas=%d\nmax_map_count=%d\nnr_mergeable=%d\n", nvmas, mmc, nmerge)
+  printf("nr_holes=%d\nhole_total=%.0f\n", nholes, htot)
+  printf("largest_hole=%.0f\nlargest_hole_start=%s\n", big, (big_at == "") ? "0" : big_at)
+  printf("mmap_hole=%.0f\nmmap_hole_start=%s\n", mbig, (mbig_at == "") ? "0" : mbig_at)
+  for (i = 1; i <= nb; i++)
+    printf("hist_%s=%d,%.0f\n", bname[i], hcnt[i], hbytes[i])
+}' ${1} > ${2}
+[ ${DEBUG} -eq 0 ] && rm -f ${cand} ${cow} || true
+} # end vas_frag()
+
+# watch_vas()
+# --watch=INTERVAL : keep monitoring the process's (userspace) VAS, showing
+# - every INTERVAL seconds - only the mappings that have been added, removed,
+# or have grown or shrunk (or changed permissions) since the last tick.
+# It's a single long-running awk: the previous tick's segment table stays in
+# it's memory (two tables, used alternately, so there's no copying), and each
+# tick is one sorted-merge pass against the newly read maps (it's already
+# sorted by va); unchanged lines are just compared, only the differing ones
+# are parsed. So no re-sort, no temp files and - bar the sleep(1) - no forks
+# per tick. A mapping whose start va changes while it's end and name don't
+# (as a downward-growing stack's does) is reported as having grown/shrunk,
+# not as removed + added.
+# Runs until the process dies (or ^C).
+# Parameters:
+#   $1 = PID
+#   $2 = interval (seconds; can be fractional)
+watch_vas()
+{
+local c_add c_del c_chg c_rst
+c_add=$(fg_green) ; c_del=$(fg_red) ; c_chg=$(fg_blue) ; c_rst=$(color_reset)
+
+echo "[i] watching the userspace VAS of PID $1 every $2s; ^C to stop"
+awk -v maps=/proc/$1/maps -v iv=$2 -v c_add="${c_add}" -v c_del="${c_del}" \
+    -v c_chg="${c_chg}" -v c_rst="${c_rst}" "${AWK_HEXLIB}"'
+# Read the maps lines into tbl[]; returns the # of VMAs, -1 if the process is gone
+function readmaps(tbl,   ln, n, r) {
+  n = 0
+  while ((r = (getline ln < maps)) > 0)
+    tbl[++n] = ln
+  close(maps)
+  return (r < 0 && n == 0) ? -1 : n
+}
+# Parse a maps line into V_S, V_E (16 digit hex), V_M (perms) and V_N (name)
+function parse(ln,   f, nf, i, va) {
+  nf = split(ln, f, " ")
+  split(f[1], va, "-")
+  V_S = pad16(va[1]) ; V_E = pad16(va[2]) ; V_M = f[2]
+  V_N = f[6] ; for (i = 7; i <= nf; i++) V_N = V_N " " f[i]
+  if (V_N == "") V_N = "[anon]"
+}
+function show(tag, col, s, e, nm, mode, extra) {
+  printf("%s%s |%20.20s [%10s,%s] 0x%s - 0x%s%s%s\n", col, tag, nm, \
+	  hsz(hexdiff(e, s)), mode, s, e, extra, c_rst)
+}
+function grown(d) { return sprintf("  (%s%s)", (d > 0) ? "+" : "", hsz(d)) }
+# One tick: diff the previous (P, np lines) and current (C, nc lines) tables
+function diff(P, np, C, nc,   i, j, k, nadd, ndel, nchg, delta, d, ps, pe, pm, pn, \
+		rm, add, nout, key) {
+  nadd = ndel = nchg = delta = nout = 0
+  i = j = 1
+  while (i <= np || j <= nc) {
+    if (i <= np && j <= nc && P[i] == C[j]) { i++ ; j++ ; continue }
+    if (j > nc) { parse(P[i]) ; rm[V_E SUBSEP V_N] = P[i] ; i++ ; continue }
+    if (i > np) { add[++nout] = C[j] ; j++ ; continue }
+    parse(P[i]) ; ps = V_S ; pe = V_E ; pm = V_M ; pn = V_N
+    parse(C[j])
+    if (ps < V_S) {                                 # removed
+      rm[pe SUBSEP pn] = P[i] ; i++
+    } else if (V_S < ps) {                          # added
+      add[++nout] = C[j] ; j++
+    } else {                                        # same start va
+      if (pn != V_N) {
+        rm[pe SUBSEP pn] = P[i] ; add[++nout] = C[j]
+      } else if (pe != V_E || pm != V_M) {
+        d = (V_E > pe) ? hexdiff(V_E, pe) : -hexdiff(pe, V_E)
+        delta += d ; nchg++
+        show((d > 0) ? ">" : ((d < 0) ? "<" : "~"), c_chg, V_S, V_E, V_N, V_M, \
+		(d != 0) ? grown(d) : sprintf("  (was %s)", pm))
+      }
+      i++ ; j++
+    }
+  }
+  # an added VMA with the same end va and name as a removed one has just
+  # moved its start: it grew / shrank downward (f.e. the stack)
+  for (k = 1; k <= nout; k++) {
+    parse(add[k]) ; key = V_E SUBSEP V_N
+    if (key in rm) {
+      ps = V_S ; parse(rm[key]) ; delete rm[key]
+      d = (ps < V_S) ? hexdiff(V_S, ps) : -hexdiff(ps, V_S)
+      delta += d ; nchg++
+      parse(add[k])
+      show((d > 0) ? ">" : "<", c_chg, V_S, V_E, V_N, V_M, grown(d))
+    } else {
+      delta += hexdiff(V_E, V_S) ; nadd++
+      show("+", c_add, V_S, V_E, V_N, V_M, "")
+    }
+  }
+  for (key in rm) {
+    parse(rm[key]) ; delta -= hexdiff(V_E, V_S) ; ndel++
+    show("-", c_del, V_S, V_E, V_N, V_M, "")
+  }
+  if (nadd + ndel + nchg)
+    printf("--- tick %d: %d VMAs; +%d -%d ~%d; VAS %s%s\n", tick, nc, nadd, ndel, nchg, \
+	  (delta >= 0) ? "+" : "", hsz(delta))
+  fflush()
+}
+BEGIN {
+  if ((na = readmaps(A)) < 0) exit 1
+  tick = 0
+  while (1) {
+    # (system() ignores SIGINT while waiting; so a ^C shows up as sleep failing)
+    if (system("sleep " iv) != 0) exit 0
+    tick++
+    # the tables alternate: A holds the previous one on odd ticks, B on even;
+    # (stale entries past the line count are simply ignored; no clearing)
+    if (tick % 2) {
+      if ((nb = readmaps(B)) < 0) break
+      diff(A, na, B, nb)
+    } else {
+      if ((na = readmaps(A)) < 0) break
+      diff(B, nb, A, na)
+    }
+  }
+  print "[i] process gone; stopping the watch"
+}'
+} # end watch_vas()
+
+# mm_trace()
+# --trace=SECONDS : trace the process's mmap, munmap, mremap, mprotect and brk
+# calls for SECONDS (or until ^C), via the procmap kernel module's 'mm_trace'
+# debugfs file - event driven, so even short-lived mappings, that polling the
+# maps (as --watch does) would miss, are seen, and there's no walk of the VAS
+# per tick. The module logs the events into per-CPU rings; we drain them every
+# second, in one batch (a single read, merged into time order by a sort(1)).
+# It's a single long-running awk: the segment table - initially from the maps
+# - is kept up to date from the events, each second's churn is shown on one
+# line and, at the end, the summary: the event counts and rates, the memory
+# mapped / unmapped, the mappings that came and went within the trace (that
+# polling would likely have missed) and the top call sites by size, resolved
+# (against the segment table) to the image and it's offset.
+# Parameters:
+#   $1 = PID
+#   $2 = duration (seconds)
+mm_trace()
+{
+local tracef=${DBGFS_LOC}/${KMOD}/${DBGFS_MMTRACE_FILENAME}
+[ -w ${tracef} ] || {
+   echo "[!] --trace: needs the procmap kernel module loaded (with mm_trace support) and root; skipping it"
+   return
+}
+echo $1 > ${tracef} 2>/dev/null || {
+   echo "[!] --trace: couldn't start tracing PID $1"
+   return
+}
+# However we end - ^C, a kill, the terminal going away, an error - stop the
+# trace: else the kretprobes stay armed (system wide) until the LKM notices
+# that we're gone
+trap "echo 0 > ${tracef} 2>/dev/null" EXIT INT
+trap "echo 0 > ${tracef} 2>/dev/null ; exit 1" TERM HUP
+echo "[i] tracing the mmap/munmap/mremap/mprotect/brk calls of PID $1 for $2s; ^C to stop"
+awk -v maps=/proc/$1/maps -v stat=/proc/$1/stat -v tracef=${tracef} -v secs=$2 -v topn=${MMTRACE_TOPN} "${AWK_HEXLIB}"'
+function bit(n, b) { return int(n / b) % 2 }
+# The segment table is a treap - a search tree on the start address, kept
+# balanced by a random (heap ordered) priority per node - so looking up a va,
+# or the mappings a range overlaps, takes O(log n) steps, not a scan of all n
+# of them, per event. A node: S, E, M, N, O (start, end, perms, name, offset),
+# the children TL and TR, the priority PR; root is the tree, live the count.
+function node(s, e, m, nm, off) {
+  nv++ ; S[nv] = s ; E[nv] = e ; M[nv] = m ; N[nv] = nm ; O[nv] = off
+  TL[nv] = TR[nv] = 0 ; PR[nv] = rand() ; live++
+  return nv
+}
+# Split the tree t into sl (the nodes that start below k) and sr (the rest)
+function tsplit(t, k) {
+  if (!t) { sl = sr = 0 ; return }
+  if (S[t] < k) { tsplit(TR[t], k) ; TR[t] = sl ; sl = t }
+  else { tsplit(TL[t], k) ; TL[t] = sr ; sr = t }
+}
+# Join the trees a and b; all of a lie below all of b
+function tmerge(a, b) {
+  if (!a) return b
+  if (!b) return a
+  if (PR[a] > PR[b]) { TR[a] = tmerge(TR[a], b) ; return a }
+  TL[b] = tmerge(a, TL[b]) ; return b
+}
+function tlast(t) {
+  if (t) while (TR[t]) t = TR[t]
+  return t
+}
+function tdrop(t) {
+  if (!t) return
+  tdrop(TL[t]) ; tdrop(TR[t]) ; live--
+  delete S[t] ; delete E[t] ; delete M[t] ; delete N[t] ; delete O[t]
+  delete TL[t] ; delete TR[t] ; delete PR[t]
+}
+function tperm(t, m) {
+  if (!t) return
+  M[t] = substr(m, 1, 3) substr(M[t], 4, 1) ; tperm(TL[t], m) ; tperm(TR[t], m)
+}
+function add(s, e, m, nm, off,   t, l) {
+  t = node(s, e, m, nm, off)
+  tsplit(root, s) ; l = sl
+  root = tmerge(tmerge(l, t), sr)
+}
+# Cut the mapping p at b: p keeps the part below, the part above is returned
+function cut(p, b,   t) {
+  t = node(b, E[p], M[p], N[p], O[p] + (b - S[p])) ; E[p] = b
+  return t
+}
+# Unmap [a, b): trim, split or drop the mappings that overlap it
+function unmap(a, b,   l, m, r, p) {
+  tsplit(root, a) ; l = sl ; tsplit(sr, b) ; m = sl ; r = sr
+  # (the last mapping below the range may run into, or across, it; the last
+  # one in it, past it)
+  p = tlast(l)
+  if (p && E[p] > a) {
+    if (E[p] > b) r = tmerge(cut(p, b), r)
+    E[p] = a
+  }
+  p = tlast(m)
+  if (p && E[p] > b) r = tmerge(cut(p, b), r)
+  tdrop(m)
+  root = tmerge(l, r)
+}
+# Change the permissions of [a, b) to m (splitting mappings as required)
+function protect(a, b, m,   l, mid, r, p) {
+  tsplit(root, a) ; l = sl ; tsplit(sr, b) ; mid = sl ; r = sr
+  p = tlast(l)
+  if (p && E[p] > a) {
+    p = cut(p, a)
+    if (E[p] > b) r = tmerge(cut(p, b), r)
+    mid = tmerge(p, mid)
+  }
+  p = tlast(mid)
+  if (p && E[p] > b) r = tmerge(cut(p, b), r)
+  tperm(mid, m)
+  root = tmerge(tmerge(l, mid), r)
+}
+function find(va,   t, f) {
+  t = root ; f = 0
+  while (t)
+    if (S[t] <= va) { f = t ; t = TR[t] } else t = TL[t]
+  return (f && va < E[f]) ? f : 0
+}
+function perms(prot, flags) {
+  return (bit(prot, 1) ? "r" : "-") (bit(prot, 2) ? "w" : "-") (bit(prot, 4) ? "x" : "-") \
+	 (bit(flags, 1) ? "s" : "p")
+}
+# One event line: ts_ns cpu tid event addr len addr2 len2 caller
+function event(ln,   f, a, len, a2, i, m, nm, off) {
+  if (substr(ln, 1, 9) == "# dropped") { dropped += substr(ln, 11) ; return }
+  if (substr(ln, 1, 8) == "# missed") { missed += substr(ln, 10) ; return }
+  if (substr(ln, 1, 1) == "#") return
+  split(ln, f, " ")
+  a = hex2dec(f[5]) ; len = f[6] + 0 ; a2 = hex2dec(f[7])
+  nev[f[4]]++ ; tick_ev++
+  if (f[4] == "mmap") {
+    unmap(a, a + len)
+    # (MAP_ANONYMOUS is 0x20 on most arches)
+    add(a, a + len, perms(a2, f[8]), bit(f[8], 32) ? "[anon]" : "[file]", 0)
+    mapped += len ; tick_map += len
+    born[f[5]] = f[1] ; bornlen[f[5]] = len
+    site[f[9]] += len ; sitecnt[f[9]]++
+  } else if (f[4] == "munmap") {
+    unmap(a, a + len)
+    unmapped += len ; tick_unmap += len
+    if (f[5] in born && bornlen[f[5]] == len) {
+      shortlived++ ; lifetime += f[1] - born[f[5]] ; delete born[f[5]]
+    }
+  } else if (f[4] == "mremap") {
+    i = find(a) ; m = i ? M[i] : "rw-p" ; nm = i ? N[i] : "[anon]" ; off = i ? O[i] + (a - S[i]) : 0
+    unmap(a, a + len) ; unmap(a2, a2 + f[8])
+    add(a2, a2 + f[8], m, nm, off)
+    if (f[8] > len) { mapped += f[8] - len ; tick_map += f[8] - len ; site[f[9]] += f[8] - len ; sitecnt[f[9]]++ }
+    else { unmapped += len - f[8] ; tick_unmap += len - f[8] }
+  } else if (f[4] == "mprotect") {
+    protect(a, a + len, perms(a2, 0))
+  } else if (f[4] == "brk") {
+    # (the heap ends at the old brk; it may be empty, i.e., not there yet)
+    i = find(a - 1)
+    if (!i || N[i] != "[heap]") {
+      if (a2 > a) add(a, a2, "rw-p", "[heap]", 0)
+    } else if (a2 <= S[i])
+      unmap(S[i], E[i])
+    else
+      E[i] = a2
+    if (a2 > a) { mapped += a2 - a ; tick_map += a2 - a ; site[f[9]] += a2 - a ; sitecnt[f[9]]++ }
+    else { unmapped += a - a2 ; tick_unmap += a - a2 }
+  }
+}
+function nvmas() { return live }
+BEGIN {
+  srand()
+  # the segment table, to start with
+  while ((getline ln < maps) > 0) {
+    split(ln, f, " ") ; split(f[1], va, "-")
+    nm = f[6] ; for (i = 7; i in f; i++) nm = nm " " f[i]
+    if (nm == "") nm = "[anon]"
+    add(hex2dec(va[1]), hex2dec(va[2]), f[2], nm, hex2dec(f[3]))
+  }
+  close(maps)
+  nv0 = nvmas()
+  cmd = "sort -n " tracef
+  for (t = 0; t < secs; t++) {
+    # (a ^C shows up as sleep failing; see watch_vas())
+    if (system("sleep " ((secs - t < 1) ? secs - t : 1)) != 0) break
+    tick_ev = tick_map = tick_unmap = 0
+    while ((cmd | getline ln) > 0)
+      event(ln)
+    close(cmd)
+    if (tick_ev)
+      printf("--- %ds: %d events; mapped %s, unmapped %s; %d VMAs\n", t + 1, tick_ev,
+	     hsz(tick_map), hsz(tick_unmap), nvmas())
+    fflush()
+    if ((getline ln < stat) <= 0) { print "[i] process gone; stopping the trace" ; t++ ; break }
+    close(stat)
+  }
+  while ((cmd | getline ln) > 0)
+    event(ln)
+  close(cmd)
+  system("echo 0 > " tracef)
+  el = (t < secs) ? t : secs    # (^C ends it early)
+  if (el <= 0) el = 1
+
+  printf("\nmm event trace summary (over %.1fs):\n", el)
+  printf(" events: mmap %d  munmap %d  mremap %d  mprotect %d  brk %d  (%.1f/s; dropped %d)\n",
+	 nev["mmap"], nev["munmap"], nev["mremap"], nev["mprotect"], nev["brk"],
+	 (nev["mmap"] + nev["munmap"] + nev["mremap"] + nev["mprotect"] + nev["brk"]) / el, dropped)
+  if (missed)
+    printf(" %d call(s) missed by the kretprobes (system wide; not all of them ours)\n", missed)
+  printf(" churn: mapped %s (%s/s), unmapped %s (%s/s); VMAs %d -> %d\n", hsz(mapped),
+	 hsz(mapped / el), hsz(unmapped), hsz(unmapped / el), nv0, nvmas())
+  if (shortlived)
+    printf(" %d mapping(s) came and went within the trace (average lifetime %.3f ms)\n",
+	   shortlived, lifetime / shortlived / 1e6)
+  # the top call sites, by size mapped
+  n = 0
+  for (c in site) { n++ ; sc[n] = c }
+  if (n) printf(" top call sites, by size mapped:\n")
+  for (k = 1; k <= n && k <= topn; k++) {
+    b = k
+    for (j = k + 1; j <= n; j++) if (site[sc[j]] > site[sc[b]]) b = j
+    c = sc[b] ; sc[b] = sc[k] ; sc[k] = c
+    cva = hex2dec(c) ; i = find(cva)
+    printf("  %12s in %6d call(s)  0x%s  %s\n", hsz(site[c]), sitecnt[c], c,
+	   i ? sprintf("%s+0x%s", N[i], dec2hex(cva - S[i] + O[i])) : "?")
+  }
+}'
+echo 0 > ${tracef} 2>/dev/null || true
+trap - EXIT INT TERM HUP
+} # end mm_trace()
+
+# sysscan()
+# --all / --cgroup=PATH : scan the (userspace) VAS of many processes at once.
+# The PIDs are split into batches and scanned by a pool of workers (via
+# xargs -P); each worker's a single awk that reads, for each of it's PIDs,
+# the maps and smaps_rollup and writes one record per process plus one per
+# file-backed mapping, into it's own file (so no interleaving). A second awk
+# then interns the file-backed mappings by dev:inode:offset - so a libc or a
+# shm segment mapped by 500 processes is counted once - and reports:
+#  - the aggregate VAS, RSS, PSS and USS (unique set: private pages)
+#  - the most-mapped images (by # of processes mapping them)
+#  - per process, it's VAS split into the unique part and the part that's
+#    shared (file-backed mappings that some other scanned process maps too)
+# Parameters:
+#   $1 = file with the PIDs to scan, one per line
+#   $2 = OPTIONAL: CSV file to write the per process info to
+sysscan()
+{
+local pidfile=$1 csv=${2:-} outdir=/tmp/${name}/scan
+local nproc npids batch
+nproc=${SCAN_WORKERS}
+[ ${nproc} -le 0 ] && nproc=$(getconf _NPROCESSORS_ONLN)
+npids=$(wc -l < ${pidfile})
+[ ${npids} -eq 0 ] && { echo "${name}: no processes to scan" ; return 1 ; }
+# ~4 batches per worker, so that the load evens out
+batch=$(((npids + nproc*4 - 1) / (nproc*4)))
+rm -rf ${outdir} ; mkdir -p ${outdir}
+echo "[i] scanning ${npids} processes with ${nproc} workers ..."
+
+# Worker; the PIDs are it's arguments (ARGV), the output's to outdir/<1st PID>
+# Records:
+#  P pid vas #vmas rss pss uss swap comm   (sizes in bytes, comm last)
+#  M pid dev:inode:offset size pathname    (per file-backed mapping)
+#  S pid                                   (skipped: gone, kthread or no access)
+xargs -P ${nproc} -n ${batch} awk -v outdir=${outdir} "${AWK_HEXLIB}"'
+BEGIN {
+  out = outdir "/" ARGV[1]
+  for (a = 1; a < ARGC; a++) {
+    pid = ARGV[a] ; f = "/proc/" pid "/maps"
+    vas = n = 0
+    while ((getline ln < f) > 0) {
+      nf = split(ln, x, " ")
+      if (x[1] ~ /^ffffffffff600000-/) continue  # the (legacy) vsyscall page
+      split(x[1], va, "-") ; sz = hex2dec(va[2]) - hex2dec(va[1])
+      vas += sz ; n++
+      if (x[5] != "0") {
+        nm = x[6] ; for (i = 7; i <= nf; i++) nm = nm " " x[i]
+        print "M", pid, x[4] ":" x[5] ":" x[3], sz, nm > out
+      }
+    }
+    close(f)
+    if (n == 0) { print "S", pid > out ; continue }
+    rss = pss = uss = swap = 0
+    f = "/proc/" pid "/smaps_rollup"
+    while ((getline ln < f) > 0) {
+      split(ln, x, " ")
+      if (x[1] == "Rss:") rss = x[2]*1024
+      else if (x[1] == "Pss:") pss = x[2]*1024
+      else if (x[1] ~ /^Private_(Clean|Dirty):$/) uss += x[2]*1024
+      else if (x[1] == "Swap:") swap = x[2]*1024
+    }
+    close(f)
+    comm = "?" ; f = "/proc/" pid "/comm" ; getline comm < f ; close(f)
+    print "P", pid, vas, n, rss, pss, uss, swap, comm > out
+  }
+  close(out)
+}' < ${pidfile}
+timing_mark scan_workers
+
+awk -v outdir=${outdir} -v csv="${csv}" -v topn=${SCAN_TOPN} "${AWK_HEXLIB}"'
+$1 == "S" { nskip++ ; next }
+$1 == "M" {
+  pid = $2 ; key = $3 ; sz = $4
+  if (!((key, pid) in seen)) {
+    seen[key, pid] = 1 ; kprocs[key]++
+    # the pathname: all that follows the 4th field
+    nm = $0 ; for (i = 1; i <= 4; i++) sub(/^[^ ]+ /, "", nm)
+    kname[key] = nm
+    if (!((nm, pid) in iseen)) { iseen[nm, pid] = 1 ; iprocs[nm]++ }
+  }
+  if (sz > ksz[key]) ksz[key] = sz
+  nk[pid]++ ; pkey[pid, nk[pid]] = key ; psz[pid, nk[pid]] = sz
+  fmaps += sz
+  next
+}
+$1 == "P" {
+  pid = $2 ; np++ ; pids[np] = pid
+  vas[pid] = $3 ; nvma[pid] = $4 ; rss[pid] = $5 ; pss[pid] = $6 ; uss[pid] = $7 ; swp[pid] = $8
+  c = $0 ; for (i = 1; i <= 8; i++) sub(/^[^ ]+ /, "", c) ; comm[pid] = c
+  t_vas += $3 ; t_vma += $4 ; t_rss += $5 ; t_pss += $6 ; t_uss += $7 ; t_swp += $8
+}
+END {
+  for (k in ksz) { fint += ksz[k] ; nkeys++ }
+  for (k in ksz) { nm = kname[k] ; isz[nm] += ksz[k] }
+
+  printf("\n=== Scanned %d processes (%d skipped: exited, kernel threads or no access) ===\n", np, nskip)
+  printf(" Total VAS           : %s in %d mappings\n", hsz(t_vas), t_vma)
+  printf(" Total RSS           : %s (PSS %s, USS %s, swap %s)\n", hsz(t_rss), hsz(t_pss), hsz(t_uss), hsz(t_swp))
+  printf(" File-backed mappings: %s as mapped, %s once shared ones are counted once (%d distinct)\n", \
+	hsz(fmaps), hsz(fint), nkeys)
+
+  # the most-mapped images and the largest processes, via sort(1); the sort
+  # key(s) go first on each line and are cut off after sorting
+  printf("\n=== Most-mapped images (top %d) ===\n", topn)
+  printf("%8s %12s  %s\n", "#procs", "size", "image") ; fflush()
+  cmd = "sort -k1,1nr -k2,2nr | head -n " topn " | cut -d\" \" -f3-"
+  for (nm in iprocs)
+    printf("%d %.0f %8d %12s  %s\n", iprocs[nm], isz[nm], iprocs[nm], hsz(isz[nm]), nm) | cmd
+  close(cmd)
+
+  printf("\n=== Processes, by PSS (top %d) ===\n", topn)
+  printf("%8s %-16s %6s %12s %12s %12s %12s %12s %12s\n", "PID", "comm", "#vmas", "VAS", \
+	"VAS:unique", "VAS:shared", "RSS", "PSS", "USS") ; fflush()
+  cmd = "sort -k1,1nr | head -n " topn " | cut -d\" \" -f2-"
+  if (csv != "")
+    printf("# pid,comm,#vmas,vas,vas_unique,vas_shared,rss,pss,uss,swap (bytes)\n") > csv
+  for (p = 1; p <= np; p++) {
+    pid = pids[p] ; shr = 0
+    for (i = 1; i <= nk[pid]; i++)
+      if (kprocs[pkey[pid, i]] > 1) shr += psz[pid, i]
+    printf("%.0f %8d %-16.16s %6d %12s %12s %12s %12s %12s %12s\n", pss[pid], pid, comm[pid], nvma[pid], \
+	hsz(vas[pid]), hsz(vas[pid]-shr), hsz(shr), hsz(rss[pid]), hsz(pss[pid]), hsz(uss[pid])) | cmd
+    if (csv != "")
+      printf("%d,%s,%d,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f\n", pid, comm[pid], nvma[pid], vas[pid], \
+	  vas[pid]-shr, shr, rss[pid], pss[pid], uss[pid], swp[pid]) > csv
+  }
+  close(cmd)
+}' ${outdir}/*
+
+timing_mark scan_report
+[ ${DEBUG} -eq 0 ] && rm -rf ${outdir}
+return 0
+} # end sysscan()
+
+# snapshot_capture()
+# --capture=FILE : capture - and only capture - all that's needed to later
+# render this process's memory map, possibly on another machine (--render):
+# the process's maps, smaps, smaps_rollup, status, the system's meminfo, the
+# kernel image lines of iomem (needs root), procmap's kernel detail report
+# (KSEGFILE) and the machine details. It's kept light on the (production)
+# host being diagnosed: a single awk copies all the files over, nothing's
+# written under /tmp and nothing's computed here.
+# Snapshot format (text; gzip'ed if FILE ends in .gz):
+#  PROCMAP-SNAPSHOT <version>
+#  @meta                    ; followed by key=value lines
+#  @<section>               ; followed by the file's content, verbatim
+#  ...                      ; (none of these files have lines beginning with @)
+# Parameters:
+#   $1 = PID
+#   $2 = snapshot file
+snapshot_capture()
+{
+local pid=$1 out=$2 f files=""
+for f in /proc/${pid}/maps /proc/${pid}/smaps /proc/${pid}/smaps_rollup \
+	 /proc/${pid}/status /proc/meminfo /proc/iomem ${KSEGFILE} ; do
+  [ -r ${f} ] && files="${files} ${f}"
+done
+local exe mach osrel comm now
+exe=$(readlink /proc/${pid}/exe 2>/dev/null) || exe=""
+mach=$(uname -m)
+read -r osrel < /proc/sys/kernel/osrelease
+read -r comm < /proc/${pid}/comm
+printf -v now '%(%Y-%m-%d %H:%M:%S %z)T' -1
+
+{
+ echo "PROCMAP-SNAPSHOT ${SNAPSHOT_VERSION}"
+ echo "@meta"
+ echo "pid=${pid}"
+ echo "comm=${comm}"
+ echo "exe=${exe}"
+ echo "host=${HOSTNAME:-}"
+ echo "time=${now}"
+ echo "osrelease=${osrel}"
+ echo "machine=${mach}"
+ echo "long_bit=$(getconf LONG_BIT)"
+ # (the awk gets the sections names from the file names)
+ awk -v kseg=${KSEGFILE} '
+ FNR == 1 {
+   sect = FILENAME ; sub(/.*\//, "", sect)
+   if (FILENAME == kseg) sect = "kseg"
+   print "@" sect
+ }
+ FILENAME == "/proc/iomem" && !/Kernel/ { next }
+ { print }' ${files}
+} | if [ "${out%.gz}" != "${out}" ] ; then gzip -c > ${out} ; else cat > ${out} ; fi
+} # end snapshot_capture()
+
+# snapshot_extract()
+# --render=FILE : extract a snapshot - see snapshot_capture() above - into
+# a directory laid out as a (tiny) /proc:
+#   DIR/proc/PID/{maps,smaps,smaps_rollup,status,comm}, DIR/proc/{meminfo,iomem}
+#   DIR/kseg_dtl  : the kernel detail report
+#   DIR/meta      : the snapshot's meta info, as key=value (see snapshot_meta())
+# The snapshot comes from elsewhere, and we're (usually) root: so it isn't
+# trusted. Only the sections we write are accepted (others are skipped), the
+# meta keys must be [a-z_]+ and the pid numeric, the kseg lines must look like
+# the LKM's (else the snapshot's rejected); nothing of it's ever used as
+# (part of) a shell command or a path of it's own.
+# Parameters:
+#   $1 = snapshot file
+#   $2 = directory to extract into
+snapshot_extract()
+{
+local snap=$1 dir=$2 cat_cmd=cat
+[ "${snap%.gz}" != "${snap}" ] && cat_cmd=zcat
+rm -rf ${dir} ; mkdir -p ${dir}/proc
+${cat_cmd} ${snap} | awk -v dir=${dir} -v ver=${SNAPSHOT_VERSION} -v dl="${gDELIM}" '
+NR == 1 {
+  if ($1 != "PROCMAP-SNAPSHOT") { print "not a procmap snapshot" > "/dev/stderr" ; exit 1 }
+  if ($2 > ver) { print "snapshot version " $2 " is newer than ours (" ver ")" > "/dev/stderr" ; exit 1 }
+  next
+}
+/^@/ {
+  if (out != "") close(out)
+  sect = substr($0, 2) ; out = ""
+  if (sect == "meta") out = dir "/meta"
+  else if (sect == "kseg") out = dir "/kseg_dtl"
+  else if (sect == "meminfo" || sect == "iomem") out = dir "/proc/" sect
+  else if (sect ~ /^(maps|smaps|smaps_rollup|status)$/) {
+    if (pid == "") { print "snapshot: no (valid) pid before the @" sect " section" > "/dev/stderr" ; exit 1 }
+    out = dir "/proc/" pid "/" sect
+  } else
+    printf("snapshot: unknown section @%s skipped\n", sect) > "/dev/stderr"
+  if (out != "") printf("") > out
+  next
+}
+out == "" { next }
+# the kseg fields end up in the ARCHFILE (which is sourced), so they must be
+# what the LKM writes: start,end,perms,label or NAME,value ; hex numbers
+sect == "kseg" {
+  n = split($0, f, dl)
+  if (!(n == 4 && f[1] ~ /^(0x)?[0-9a-f]+$/ && f[2] ~ /^(0x)?[0-9a-f]+$/ &&
+        f[3] ~ /^[r-][w-][x-]$/ && f[4] ~ /^[A-Za-z0-9 _.:()\/-]+$/) &&
+      !(n == 2 && f[1] ~ /^[A-Z_]+$/ && f[2] ~ /^(0x)?[0-9a-f]+$/)) {
+    printf("snapshot: bad @kseg line %d: %s\n", NR, $0) > "/dev/stderr"
+    exit 1
+  }
+}
+sect == "meta" {
+  k = $0 ; sub(/=.*/, "", k) ; v = substr($0, length(k) + 2)
+  if (k !~ /^[a-z_]+$/) next
+  if (k == "pid") {
+    if (v !~ /^[0-9]+$/ || pid != "") next
+    pid = v ; system("mkdir -p " dir "/proc/" pid)
+  } else if (k == "comm")
+    comm = v
+  print k "=" v > out
+  next
+}
+{ print > out }
+END { if (pid != "") print comm > (dir "/proc/" pid "/comm") }'
+} # end snapshot_extract()
+
+# snapshot_meta()
+# Read the meta file of an extracted snapshot (or core; see core_extract())
+# into the SNAP_<key> variables. It's read, never sourced (the values come
+# from the snapshot or core: the process's comm, exe pathname, ...); only the
+# keys we know are taken, and the numeric ones must be numbers.
+# Parameters:
+#   $1 = meta file
+snapshot_meta()
+{
+local k v
+SNAP_pid="" SNAP_comm="" SNAP_exe="" SNAP_host="" SNAP_time=""
+SNAP_osrelease="" SNAP_machine="" SNAP_long_bit=""
+while IFS="=" read -r k v ; do
+  case "${k}" in
+    pid|long_bit) [[ "${v}" =~ ^[0-9]+$ ]] || continue ;;
+    comm|exe|host|time|osrelease|machine) ;;
+    *) continue ;;
+  esac
+  printf -v "SNAP_${k}" '%s' "${v}"
+done < $1
+} # end snapshot_meta()
+
+# core_extract()
+# --core=FILE : build - from an ELF core dump, with no live process - the same
+# (tiny) /proc a snapshot extracts to (see snapshot_extract() above), so that
+# it's rendered the same way:
+#   DIR/proc/PID/{maps,status,comm,smaps}  ; (smaps is empty: a core has none)
+#   DIR/meta                               ; key=value (see snapshot_meta())
+# Only the ELF and program headers and the notes are read - each with one
+# od(1), which seeks straight to them - and parsed as they stream by; the
+# memory contents (the bulk of a core) are never touched, so even a huge
+# core takes about as long as a tiny one.
+#  - each PT_LOAD is a mapping (start, size, permissions)
+#  - the NT_FILE note names the file-backed ones (and gives their offsets)
+#  - NT_PRPSINFO has the PID and command; NT_AUXV lets us name the [stack]
+#    (it holds AT_EXECFN), the [vdso] (AT_SYSINFO_EHDR) and the executable
+#    (it holds AT_ENTRY); the anonymous mapping right above the executable's
+#    mappings is taken to be the [heap]
+# A core doesn't record whether a mapping's private or shared: all are shown
+# as private. Both 32 and 64-bit, little and big endian, cores are handled,
+# as is an e_phnum overflow (PN_XNUM; > 65534 mappings).
 # Parameters:
-#   $1 : size of the sparse region (decimal, bytes)
-inc_sparse()
+#   $1 = core file
+#   $2 = directory to extract into
+core_extract()
 {
-  [ ${SPARSE_SHOW} -eq 1 ] && {
-    let gNumSparse=gNumSparse+1
-    let gTotalSparseSize=gTotalSparseSize+$1
+local core=$1 dir=$2 hdr class data etype mach phoff phsz phnum shoff
+local loads=${2}/loads notes=${2}/notes info noff nsz
+rm -rf ${dir} ; mkdir -p ${dir}/proc
+
+# the ELF header: class data e_type e_machine e_phoff e_phentsize e_phnum e_shoff
+hdr=$(od -An -v -tu1 -N64 ${core} 2>/dev/null | awk '
+{ for (i = 1; i <= NF; i++) b[n++] = $i }
+function u(off, len,   i, v) {
+  v = 0
+  for (i = len - 1; i >= 0; i--) v = v * 256 + b[(le ? off + i : off + len - 1 - i)]
+  return v
+}
+END {
+  if (n < 52 || b[0] != 127 || b[1] != 69 || b[2] != 76 || b[3] != 70) exit 1
+  cl = b[4] ; le = (b[5] == 1)
+  if (cl == 2) printf("%d %d %d %d %.0f %d %d %.0f\n", cl, b[5], u(16, 2), u(18, 2), u(32, 8), u(54, 2), u(56, 2), u(40, 8))
+  else printf("%d %d %d %d %.0f %d %d %.0f\n", cl, b[5], u(16, 2), u(18, 2), u(28, 4), u(42, 2), u(44, 2), u(32, 4))
+}') || {
+   echo "${core}: not an ELF file" 1>&2
+   return 1
+}
+read -r class data etype mach phoff phsz phnum shoff <<< "${hdr}"
+[ ${etype} -ne 4 ] && {
+   echo "${core}: not a core dump (ELF type ${etype})" 1>&2
+   return 1
+}
+# PN_XNUM: the real # of program headers is in the 1st section header's sh_info
+[ ${phnum} -eq 65535 ] && {
+   phnum=$(od -An -v -tu1 -j ${shoff} -N64 ${core} | awk -v cl=${class} -v le=$((data == 1)) '
+   { for (i = 1; i <= NF; i++) b[n++] = $i }
+   END {
+     off = (cl == 2) ? 44 : 28 ; v = 0
+     for (i = 3; i >= 0; i--) v = v * 256 + b[(le ? off + i : off + 3 - i)]
+     print v
+   }')
+}
+
+# The program headers, one per line: the loads (vaddr memsz flags), in va
+# order, to ${loads}; the notes (offset filesz) to stdout
+info=$(od -An -v -tu1 -w${phsz} -j ${phoff} -N $((phnum * phsz)) ${core} | \
+awk -v cl=${class} -v le=$((data == 1)) -v loads=${loads} '
+function u(off, len,   i, v) {
+  v = 0
+  for (i = len - 1; i >= 0; i--) v = v * 256 + $((le ? off + i : off + len - 1 - i) + 1)
+  return v
+}
+{
+  type = u(0, 4)
+  if (cl == 2) { flags = u(4, 4) ; off = u(8, 8) ; va = u(16, 8) ; fsz = u(32, 8) ; msz = u(40, 8) }
+  else { off = u(4, 4) ; va = u(8, 4) ; fsz = u(16, 4) ; msz = u(20, 4) ; flags = u(24, 4) }
+  if (type == 1) printf("%.0f %.0f %d\n", va, msz, flags) > loads
+  else if (type == 4) printf("%.0f %.0f\n", off, fsz)
+}')
+[ -s ${loads} ] || {
+   echo "${core}: no PT_LOAD segments (a truncated core?)" 1>&2
+   return 1
+}
+
+# The notes, streamed a 4-byte word per line; the ones of interest to ${notes}:
+#  P pid fname  ; A type value  ; F start end offset name  ; S page_size
+: > ${notes}
+while IFS=" " read -r noff nsz ; do
+  [ -z "${noff}" ] && continue
+  od -An -v -tu1 -w4 -j ${noff} -N ${nsz} ${core} | \
+  awk -v ws=$((class == 2 ? 8 : 4)) -v le=$((data == 1)) '
+  function w() { return le ? $1 + $2*256 + $3*65536 + $4*16777216 : $4 + $3*256 + $2*65536 + $1*16777216 }
+  # (control chars in the names - set by the process itself - become ?)
+  BEGIN { for (i = 1; i < 256; i++) chr[i] = (i < 32 || i == 127) ? "?" : sprintf("%c", i) ; st = "hdr" }
+  # a long (of ws bytes) is done: here it is
+  function long(v) {
+    if (ntype == 6) {           # NT_AUXV: (type, value) pairs
+      if (nl % 2) printf("A %.0f %.0f\n", atype, v) ; else atype = v
+    } else if (ntype == 1179208773) {   # NT_FILE: count page_size {start end ofs}...
+      if (nl == 0) nfile = v
+      else if (nl == 1) { pgsz = v ; printf("S %.0f\n", v) }
+      else { k = int((nl - 2) / 3) ; j = (nl - 2) % 3
+        if (j == 0) fs[k] = v ; else if (j == 1) fe[k] = v ; else fo[k] = v }
+    }
+    nl++
+  }
+  {
+    if (st == "hdr") {
+      h[nh++] = w()
+      if (nh == 3) {
+        namesz = h[0] ; descsz = h[1] ; ntype = h[2] ; nh = 0
+        namew = int((namesz + 3) / 4) ; descw = int((descsz + 3) / 4)
+        st = namew ? "name" : "desc" ; nw = 0 ; nl = 0 ; part = 0 ; nb = 0 ; fname = "" ; kf = 0 ; nfile = 0
+        owner = ""
+        if (!namew && !descw) st = "hdr"
+      }
+      next
+    }
+    if (st == "name") {
+      if (nw == 0) owner = $1
+      if (++nw == namew) { st = descw ? "desc" : "hdr" ; nw = 0 }
+      next
+    }
+    # the desc
+    nw++
+    if (owner == 67) {          # (C)ORE
+      if (ntype == 3) {         # NT_PRPSINFO: ... pr_pid ... pr_fname[16] pr_psargs[80]
+        for (i = 1; i <= 4; i++) pb[nb++] = $i
+      } else if (ntype == 6 || (ntype == 1179208773 && nl < 2 + 3 * nfile)) {
+        if (ws == 4) long(w())
+        else if (!part) { lw = w() ; part = 1 }
+        else { part = 0 ; long(le ? lw + w() * 4294967296 : lw * 4294967296 + w()) }
+      } else if (ntype == 1179208773) {   # the names, NUL terminated, in order
+        for (i = 1; i <= 4 && kf < nfile; i++) {
+          if ($i == 0) { printf("F %.0f %.0f %.0f %s\n", fs[kf], fe[kf], fo[kf] * pgsz, fname) ; kf++ ; fname = "" }
+          else fname = fname chr[$i]
+        }
+      }
+    }
+    if (nw == descw) {
+      if (owner == 67 && ntype == 3) {
+        p = descsz - 112 ; pid = le ? pb[p] + pb[p+1]*256 + pb[p+2]*65536 + pb[p+3]*16777216 : \
+			       pb[p+3] + pb[p+2]*256 + pb[p+1]*65536 + pb[p]*16777216
+        fn = "" ; for (i = descsz - 96; i < descsz - 80 && pb[i]; i++) fn = fn chr[pb[i]]
+        printf("P %d %s\n", pid, fn)
+      }
+      st = "hdr" ; nw = 0
+    }
+  }' >> ${notes}
+done <<< "${info}"
+
+# Put it all together: the maps (naming what we can), comm, status and meta
+awk -v dir=${dir} -v cl=${class} -v mach=${mach} \
+    -v when="$(date -r ${core} '+%Y-%m-%d %H:%M:%S %z' 2>/dev/null)" "${AWK_HEXLIB}"'
+function pad(h) { return (length(h) < 8) ? substr("00000000", 1, 8 - length(h)) h : h }
+FNR == NR {
+  if ($1 == "P") { pid = $2 ; comm = substr($0, length($1 $2) + 3) }
+  else if ($1 == "A") aux[$2] = $3
+  else if ($1 == "F") {
+    nm = $0 ; for (i = 1; i <= 4; i++) sub(/^[^ ]* /, "", nm)
+    fname[$2] = nm ; foff[$2] = $4
+  }
+  next
+}
+{ n++ ; s[n] = $1 ; e[n] = $1 + $2 ; fl[n] = $3 }
+END {
+  if (pid == "") pid = 1
+  # the executable: the file holding AT_ENTRY (9)
+  for (i = 1; i <= n; i++) {
+    if ((s[i] in fname) && (9 in aux) && aux[9] >= s[i] && aux[9] < e[i]) exe = fname[s[i]]
+    if (exe != "" && (s[i] in fname) && fname[s[i]] == exe) exelast = i
+  }
+  dir = dir "/proc/" pid ; system("mkdir -p " dir)
+  # (backwards, so that the read-only page(s) right below the vdso are the [vvar])
+  for (i = n; i >= 1; i--) {
+    lbl[i] = "" ; off[i] = 0
+    if (s[i] in fname) { lbl[i] = fname[s[i]] ; off[i] = foff[s[i]] }
+    else if ((33 in aux) && s[i] == aux[33]) lbl[i] = "[vdso]"
+    else if ((31 in aux) && aux[31] >= s[i] && aux[31] < e[i]) lbl[i] = "[stack]"
+    else if (i == exelast + 1 && exelast && int(fl[i] / 2) % 2) lbl[i] = "[heap]"
+    else if (i < n && e[i] == s[i+1] && lbl[i+1] ~ /^\[v(dso|var)]/ && fl[i] == 4) lbl[i] = "[vvar]"
+    else if (cl == 2 && s[i] == 18446744073699065856) lbl[i] = "[vsyscall]"
   }
-} # end inc_sparse()
+  for (i = 1; i <= n; i++)
+    printf("%s-%s %s%s%s%s %s 00:00 %d %s\n", pad(dec2hex(s[i])), pad(dec2hex(e[i])),
+	   (int(fl[i] / 4) % 2) ? "r" : "-", (int(fl[i] / 2) % 2) ? "w" : "-",
+	   (fl[i] % 2) ? "x" : "-", "p", pad(dec2hex(off[i])), (lbl[i] ~ /^\//) ? 1 : 0, lbl[i]) > (dir "/maps")
+  printf("%s\n", comm) > (dir "/comm")
+  printf("Name:\t%s\nPid:\t%d\n", comm, pid) > (dir "/status")
+  printf("") > (dir "/smaps")
+  m = (mach == 62) ? "x86_64" : (mach == 183) ? "aarch64" : (mach == 40) ? "armv7l" : \
+      (mach == 3) ? "i686" : "unknown(" mach ")"
+  meta = dir "/../../meta"
+  printf("pid=%d\ncomm=%s\nexe=%s\n", pid, comm, exe) > meta
+  printf("machine=%s\nlong_bit=%d\n", m, (cl == 2) ? 64 : 32) > meta
+  printf("time=%s\nhost=(core)\n", when) > meta
+}' ${notes} ${loads}
+# (the kernel leaves NT_FILE out of cores with 64k or more mappings)
+grep -q "^F " ${notes} || echo "[!] ${core}: no NT_FILE note; the file-backed mappings can't be named" 1>&2
+rm -f ${notes} ${loads}
+} # end core_extract()
 
 # Display the number passed in a human-readable fashion
 # As appropriate, also in KB, MB, GB, TB
@@ -118,6 +1403,109 @@ largenum_display()
 	 fi
 } # end largenum_display()
 
+# profile_key()
+# The kernel/arch profile (see profile_load() below) is valid only for the
+# kernel - and boot - it was computed upon; this is it's key: the kernel
+# release and the boot ID (the layout can change across boots, f.e. w/ KASLR).
+# Sets PROFILE_KEY; no subprocesses.
+profile_key()
+{
+ local rel bid=""
+ IFS=" " read -r rel < /proc/sys/kernel/osrelease || return 1
+ [ -r /proc/sys/kernel/random/boot_id ] && IFS=" " read -r bid < /proc/sys/kernel/random/boot_id
+ PROFILE_KEY="${rel} ${bid}"
+}
+
+# profile_load()
+# Load the precomputed kernel/arch profile - what parse_ksegfile_write_archfile()
+# and get_machine_set_arch_config() work out at startup (the ARCHFILE content
+# and the machine description) - in one read, if there's a valid one: it's
+# key matches (see profile_key()) and it isn't older than the KSEGFILE.
+# The installer writes it to PROFILE_FILE; when that's missing or stale (and
+# we can't write there), it's (re)computed into PROFILE_CACHE, per user.
+# Not used when rendering a snapshot (another machine's).
+# Profile format:
+#  # procmap profile: <key>
+#  # MACH_DESC=<machine description>
+#  <the ARCHFILE lines>
+# Returns 0 if loaded (ARCHFILE's written and MACH_DESC set), else 1.
+profile_load()
+{
+ [ "${PROC_ROOT}" != "/proc" ] && return 1
+ profile_key || return 1
+ local f l1 l2 lines
+ for f in ${PROFILE_FILE} ${PROFILE_CACHE} ; do
+   [ -r ${f} ] || continue
+   [ ${KSEGFILE} -nt ${f} ] && continue
+   {
+     IFS= read -r l1 && IFS= read -r l2 && mapfile -t lines
+   } < ${f} || continue
+   [ "${l1}" != "# procmap profile: ${PROFILE_KEY}" ] && continue
+   [ "${l2:0:12}" != "# MACH_DESC=" ] && continue
+   profile_sane "${lines[@]}" || continue
+   MACH_DESC=${l2:12}
+   printf "%s\n" "${lines[@]}" > ${ARCHFILE}
+   decho "loaded the kernel/arch profile ${f}"
+   return 0
+ done
+ return 1
+}
+
+# profile_sane()
+# A profile's only of use if the kernel details it was worked out from were
+# complete: PAGE_SIZE and TASK_SIZE must be there, and nonzero (else, f.e.,
+# with a partial KSEGFILE, the bogus values would be cached and reused by
+# every run); and every line must be a plain VAR=value. Checked on both save
+# and load.
+# Parameters:
+#   $@ = the ARCHFILE lines
+# Returns 0 if sane, else 1.
+profile_sane()
+{
+ local l ps="" ts=""
+ for l in "$@" ; do
+   case "${l}" in
+     PAGE_SIZE=*) ps=${l#PAGE_SIZE=} ;;
+     TASK_SIZE=*) ts=${l#TASK_SIZE=} ;;
+   esac
+ done
+ [[ "${ps}" =~ ^(0x)?0*$ || "${ts}" =~ ^(0x)?0*$ ]] && return 1
+ # it's written to the ARCHFILE, which is sourced: plain VAR=value lines only
+ for l in "$@" ; do
+   [[ -z "${l}" || "${l}" =~ ^[A-Za-z_0-9]+=[%A-Za-z_0-9]*$ ]] || return 1
+ done
+ return 0
+}
+
+# profile_save()
+# Save the profile (see profile_load() above); called once the ARCHFILE's
+# complete, i.e., at the end of get_machine_set_arch_config(). Sets
+# PROFILE_SAVED to the file written (empty if it couldn't be, or if the
+# details aren't sane - see profile_sane()).
+profile_save()
+{
+ PROFILE_SAVED=""
+ [ "${PROC_ROOT}" != "/proc" ] && return 0
+ profile_key || return 0
+ local lines
+ mapfile -t lines < ${ARCHFILE}
+ profile_sane "${lines[@]}" || {
+   decho "kernel details incomplete (PAGE_SIZE/TASK_SIZE); the profile's not saved"
+   return 0
+ }
+ local f=${PROFILE_FILE}
+ if [ ! -w ${f} ] && [ ! -w $(dirname ${f}) -o -e ${f} ] ; then
+   f=${PROFILE_CACHE}
+   mkdir -p $(dirname ${f}) 2>/dev/null || return 0
+ fi
+ {
+  echo "# procmap profile: ${PROFILE_KEY}"
+  echo "# MACH_DESC=${MACH_DESC}"
+  cat ${ARCHFILE}
+ } > ${f}.$$ 2>/dev/null && mv -f ${f}.$$ ${f} && PROFILE_SAVED=${f} || rm -f ${f}.$$
+ true
+}
+
 # parse_ksegfile_write_archfile()
 # Here, we parse information obtained via procmap's kernel component - the
 # procmap LKM (loadable kernel module); it's already been written into the
@@ -144,10 +1532,20 @@ parse_ksegfile_write_archfile()
  PAGE_SIZE=$(grep -w "PAGE_SIZE" ${KSEGFILE} |cut -d"${gDELIM}" -f2) || PAGE_SIZE=""
  TASK_SIZE=$(grep -w "TASK_SIZE" ${KSEGFILE} |cut -d"${gDELIM}" -f2) || TASK_SIZE=""
 
- # Delete the PAGE_SIZE and TASK_SIZE lines from the KSEGFILE file
- # as we don't want it in the kernel map processing loop that follows
- sed --in-place '/^PAGE_SIZE/d' ${KSEGFILE} 2>/dev/null || true
- sed --in-place '/^TASK_SIZE/d' ${KSEGFILE} 2>/dev/null || true
+ # (The PAGE_SIZE and TASK_SIZE lines are skipped by the kernel map processing
+ # loop; we don't delete them from the KSEGFILE - it's the installed report and
+ # has to remain intact for the next run)
+
+ # The ARCHFILE's sourced (as root); the KSEGFILE may be a snapshot's, from
+ # elsewhere: so only (hex) numbers get in, anything else is left empty
+ local v
+ for v in VECTORS_BASE FIXADDR_START MODULES_VADDR MODULES_END KASAN_SHADOW_START \
+	KASAN_SHADOW_END VMALLOC_START VMALLOC_END PAGE_OFFSET PKMAP_BASE PAGE_SIZE TASK_SIZE ; do
+   [[ "${!v}" =~ ^(0x)?[0-9a-fA-F]*$ ]] || {
+     decho "kseg: ${v} isn't a number; ignored"
+     printf -v ${v} '%s' ""
+   }
+ done
 
 # We *require* these 'globals' again later in the script;
 # So we place them into an 'arch' file (we try and keep a 'descending order
@@ -468,7 +1866,8 @@ get_machine_set_arch_config()
 {
 # 32 or 64 bit OS?
 IS_64_BIT=1
-local bitw=$(getconf LONG_BIT)
+local bitw=${RENDER_LONG_BIT}
+[ -z "${bitw}" ] && bitw=$(getconf LONG_BIT)
 [ ${bitw} -eq 32 ] && IS_64_BIT=0  # implies 32-bit
 
 # Portable printing
@@ -484,7 +1883,8 @@ source ${ARCHFILE} 2>/dev/null || {
  echo "${name}: could not source ${ARCHFILE} ..."
 }
 
-local mach=$(uname -m)
+local mach=${RENDER_MACH}
+[ -z "${mach}" ] && mach=$(uname -m)
 local cpu=${mach:0:3}
 
 if [ "${mach}" = "x86_64" ]; then
@@ -506,7 +1906,7 @@ elif [ "${cpu}" = "x86" ]; then
       set_config_x86_32
    fi
 else
-   printf "\n\nSorry, your CPU (\"$(uname -m)\") isn't supported...\n"
+   printf "\n\nSorry, your CPU (\"${mach}\") isn't supported...\n"
    # TODO - 'pl report this'
    exit 1
 fi
@@ -517,6 +1917,7 @@ fi
   MACH_DESC="${MACH_DESC}, 32-bit OS"
 }
 
+profile_save
 show_machine_kernel_dtl
 } # end get_machine_set_arch_config()
 
@@ -565,106 +1966,51 @@ append_kernel_mapping()
   [ ${LOC_LEN} -ne 0 ] && locate_region -k $3 $4 || true
 }
 
-# do_append_userspace_mapping()
-# Append a new n-dim entry in the gArray[] data structure,
-# creating, in effect, a new mapping
-# Parameters:
-#   $1 : name of mapping/segment
-#   $2 : size (in bytes, decimal) of mapping/segment
-#   $3 : start va of mapping/segment
-#   $4 : end va of mapping/segment
-#   $5 : mode (perms) + mapping type (p|s) of mapping/segment
-#   $6 : file offset (hex) of mapping/segment
-do_append_userspace_mapping()
-{
-  # row'n' [segname],[size],[start_uva],[end_uva],[mode],[offset]
-  gArray[${gRow}]="${1}"
-  let gRow=gRow+1
-  gArray[${gRow}]=${2}
-  let gRow=gRow+1
-  gArray[${gRow}]=${3}        # start kva
-  let gRow=gRow+1
-  gArray[${gRow}]=${4}        # end (higher) kva
-  let gRow=gRow+1
-  gArray[${gRow}]="${5}"
-  let gRow=gRow+1
-  gArray[${gRow}]=${6}
-  let gRow=gRow+1
-} # end do_append_userspace_mapping()
-
-# append_userspace_mapping()
-append_userspace_mapping()
-{
-  # $3 = start va
-  # $4 = end va
-  do_append_userspace_mapping "$1" $2 $3 $4 $5 $6
-  [ ${LOC_LEN} -ne 0 ] && locate_region -u $3 $4
-}
-
-show_located_region_in_map()
-{
- # TODO: BUG: if LOC_STARTADDR is same as a segment addr, it's printed twice
-    tput bold; fg_red
-	if [ ${IS_64_BIT} -eq 1 ] ; then
-       printf "|                          %s ${FMTSPC_VA}                          |\n" \
-	        "${MARK_LOCATION}" ${LOC_STARTADDR}
-	else
-       printf "|                              %s ${FMTSPC_VA}                              |\n" \
-	        "${MARK_LOCATION}" ${LOC_STARTADDR}
-    fi
-	color_reset
-    oversized=0
-}
-
-# Kernel-only:
-# Check, if the currently printed 'end_va' matches an entry in our ARCHFILE;
-# If so, print the entry 'label' (name); f.e. 0x.... <-- PAGE_OFFSET
-# TODO: x86_64: buggy when -k option passed, ok when both VAS's are displayed
-insert_arch_label()
+# term_caps()
+# Resolve the terminal capabilities (the escape sequences) graphit() uses,
+# once: each tput is a fork, and earlier we'd several of them per row drawn.
+# They're in the TC_* globals; a capability the terminal lacks is just "".
+TC_DONE=0
+term_caps()
 {
-local end_va=$1 archfile_entry archfile_entry_label
-
- if [ "${end_va:0:2}" = "0x" ]; then
-    archfile_entry=$(grep "${end_va:2}" ${ARCHFILE})  # ${end_va:2} => leave out the '0x' part
- else
-    archfile_entry=$(grep "${end_va}" ${ARCHFILE})
- fi
- [ -z "${archfile_entry}" ] && {
-    printf "\n"
-    return
- }
-
- # Ok, we have a kernel arch entry; get it's name
- archfile_entry_label=$(echo "${archfile_entry}" |cut -d"=" -f1)
-
- # The values can overlap! F.e on some Aarch32 with a 2:2 (or 3:1) VM split,
- # both PAGE_OFFSET and MODULES_END coincide at 0x80000000 (or 0xc0000000);
- # Ditto for MODULES_VADDR and START_KVA
- local entrylen=$(echo "${archfile_entry_label}" |wc -l)
- if [ ${entrylen} -ge 2 ]; then
-    archfile_entry_label=$(tr '\n' '/' <<<"${archfile_entry_label}")
-    archfile_entry_label=${archfile_entry_label::-1}  # rm last '/'
- fi
-
- tput bold
- printf "%s  <-- %s\n" $(${FG_KVAR}) "${archfile_entry_label}"
- color_reset
-}
+[ ${TC_DONE} -eq 1 ] && return 0
+TC_BOLD=$(tput bold 2>/dev/null) || TC_BOLD=""
+TC_RESET=$(color_reset 2>/dev/null) || TC_RESET=""
+TC_MAPNAME=$(${FG_MAPNAME} 2>/dev/null) || TC_MAPNAME=""
+TC_KVAR=$(${FG_KVAR} 2>/dev/null) || TC_KVAR=""
+TC_KB=$(fg_darkgreen 2>/dev/null) || TC_KB=""
+TC_MB=$(fg_navyblue 2>/dev/null) || TC_MB=""
+TC_RED=$(fg_red 2>/dev/null) || TC_RED=""
+TC_BLACK=$(fg_black 2>/dev/null) || TC_BLACK=""
+TC_BLUE=$(fg_blue 2>/dev/null) || TC_BLUE=""
+TC_DONE=1
+} # end term_caps()
 
 #---------------------- g r a p h i t ---------------------------------
-# Iterates over the global n-dim arrays 'drawing' the vgraph.
-#  when invoked with -k, it iterates over the gkArray[] ds
-#  when invoked with -u, it iterates over the gArray[] ds
+# 'Draws' the vgraph, from the segment table.
+#  when invoked with -k, it's the kernel one (/tmp/${name}/pmkfinal)
+#  when invoked with -u, it's the userspace one (/tmp/${name}/pmufinal)
 # Data driven tech!
 #
+# The whole graph is formatted by a single awk(1) - the segment sizes in the
+# diff units, the boxes, the padding, the ARCHFILE labels (kernel), the
+# annotations - and written out (buffered) in large chunks; the terminal
+# escape sequences are resolved just once (term_caps()). Earlier, each row cost
+# several tput, printf and grep forks - painfully slow on large maps and on
+# slow (serial) consoles.
+# When the output's piped into a pager (--pager), awk blocks once the pipe's
+# full; so, only the rows actually looked at are formatted.
+#
+# Per-mapping annotations; lines of the form
+#  start_va,text
+# keyed by the (hex, no leading 0s) start va of the mapping. Each is shown
+# on it's own line within the mapping's box. Userspace ones are in
+# ${ANNOTFILE}, kernel ones in ${KANNOTFILE}.
+#
 # Parameters:
 #   $1 : -u|-k ; -u => userspace , -k = kernel-space
 graphit()
 {
-local i k
-local segname seg_sz start_va end_va mode offset flags
-local szKB=0 szMB=0 szGB=0 szTB=0 szPB=0
-
 local LIN_HIGHEST_K="+------------------  K E R N E L   V A S    end kva  ------------------+"
 local  LIN_LOWEST_K="+------------------  K E R N E L   V A S  start kva  ------------------+"
 local LIN_HIGHEST_U="+------------------      U S E R   V A S    end uva  ------------------+"
@@ -673,387 +2019,199 @@ local         LIN="+------------------------------------------------------------
 local LIN_WITHIN_REGION="|    [------------------------------------------------------------]    |"
 local ELLIPSE_LIN="~ .       .       .       .       .       .        .       .        .  ~"
 local   BOX_SIDES="|                                                                      |"
-local LIN_LOCATED_REGION="       +------------------------------------------------------+"
 local MARK_LOCATION="X"
-
-local linelen=$((${#LIN}-2))
-local oversized=0
+local FILE_TO_PARSE afile
 
 decho "+++ graphit(): param = $1"
-color_reset
+term_caps
+printf "%s" "${TC_RESET}"
 if [ "$1" = "-u" ] ; then
-   local DIM=6
-   local rows=${gRow}
-   local FILE_TO_PARSE=/tmp/${name}/pmufinal
+   FILE_TO_PARSE=/tmp/${name}/pmufinal
+   afile=${ANNOTFILE}
+   # --collapse : draw the summarized table (see collapse_user_segtable())
+   [ ${SHOW_COLLAPSE} -eq 1 -a -s /tmp/${name}/pmucollapsed ] && {
+      FILE_TO_PARSE=/tmp/${name}/pmucollapsed
+      afile=/tmp/${name}/pmucollapsed.annot
+   }
 elif [ "$1" = "-k" ] ; then
-   local DIM=5
-   local rows=${gkRow}
-   local FILE_TO_PARSE=/tmp/${name}/pmkfinal
-fi
-
-###
-# Converting from using the in-memory n-dim array to using a CSV file
-###
-IFS=$'\n'
-
-#for ((i=0; i<${rows}; i+=${DIM}))
-local REC rownum=1 totalrows=$(wc -l ${FILE_TO_PARSE} |awk '{print $1}')
-for REC in $(cat ${FILE_TO_PARSE})
-do
-	local tlen=0 len_perms len_maptype len_offset
-	local tmp1="" tmp2="" tmp3="" tmp4="" tmp5=""
-	local tmp5a="" tmp5b="" tmp5c="" tmp6=""
-	local segname_nocolor tmp1_nocolor tmp2_nocolor tmp3_nocolor
-	local tmp4_nocolor tmp5a_nocolor tmp5b_nocolor tmp5c_nocolor
-	local tmp5 tmp5_nocolor
-	local tmp7 tmp7_nocolor
-	local archfile_entry archfile_entry_label
-
-    #--- Retrieve values from the file
-#set -x
-	segname=$(echo "${REC}" | cut -d"," -f1)
-	seg_sz=$(echo "${REC}" | cut -d"," -f2)
-	start_va=$(echo "${REC}" | cut -d"," -f3)
-	end_va=$(echo "${REC}" | cut -d"," -f4)
-	mode=$(echo "${REC}" | cut -d"," -f5)
-	flags=$(echo "${REC}" | cut -d"," -f6)
-#set +x
-
-	if [ "$1" = "-u" ] ; then
-	   offset=$(echo "${REC}" | cut -d"," -f6)
-	   flags=0
-	fi
-
-		#segname=${gArray[${i}]}    # col 1 [str: the label/segment name]
-		#let k=i+1
-		#seg_sz=${gArray[${k}]}     # col 2 [int: the segment size]
-		#let k=i+2
-		#start_va=0x${gArray[${k}]}  # col 3 [int: the first number, start_va]
-		#let k=i+3
-		#end_va=0x${gArray[${k}]}    # col 4 [int: the second number, end_va]
-		#let k=i+4
-		#mode=${gArray[${k}]}       # col 5 [str: the mode+flag]
-		#let k=i+5
-		#offset=${gArray[${k}]}     # col 6 [int: the file offset]
-
-	#elif [ "$1" = "-k" ] ; then
-		#segname=${gkArray[${i}]}    # col 1 [str: the label/segment name]
-		#let k=i+1
-		#seg_sz=${gkArray[${k}]}     # col 2 [int: the segment size]
-		#let k=i+2
-		#start_va=${gkArray[${k}]}  # col 3 [int: the first number, start_va]
-		#let k=i+3
-		#end_va=${gkArray[${k}]}    # col 4 [int: the second number, end_va]
-		#let k=i+4
-		#mode=${gkArray[${k}]}       # col 5 [str: the mode+flag]
-
-
-	# Calculate segment size in diff units as required
-	if [ -z "${seg_sz}" ] ; then
-	  decho "-- invalid mapping size, skipping..."
-	  return
-	fi
-
-    szKB=$(bc <<< "${seg_sz}/1024")
-    [ ${szKB} -ge 1024 ] && szMB=$(bc <<< "scale=2; ${szKB}/1024.0") || szMB=0
-    # !EMB: if we try and use simple bash arithmetic comparison, we get a 
-    # "integer expression expected" err; hence, use bc(1):
-    szGB=0
-    if (( $(echo "${szMB} > 1024" |bc -l) )); then
-      szGB=$(bc <<< "scale=2; ${szMB}/1024.0")
-    fi
-    szTB=0
-    if (( $(echo "${szGB} > 1024" |bc -l) )); then
-      szTB=$(bc <<< "scale=2; ${szGB}/1024.0")
-    fi
-    szPB=0
-    if (( $(echo "${szTB} > 1024" |bc -l) )); then
-      szPB=$(bc <<< "scale=2; ${szTB}/1024.0")
-    fi
-	#decho "@@@ i=$i/${rows} , seg_sz = ${seg_sz}"
-
-decho "nm = ${segname} ,  end_va = ${end_va}   ,   start_va = ${start_va}"
-
-
-    #--- Drawing :-p  !
-	# the horizontal line with the end uva at the end of it
-	#=====================================
-	# the first actual print emitted!
-	# Eg.
-	# +----------------------------------------------------------------------+ 000055681263b000
-	# Changed to end_va @EOL as we now always print in descending order
-
-    #if [ "$1" = "-k" -a ${i} -eq $((${rows}-${DIM})) ] ; then   # last loop iteration
-    #   if [ ${IS_64_BIT} -eq 1 ] ; then
-    #if [ ${i} -eq $((${rows}-${DIM})) ] ; then                   # last loop iteration
-
-        #elif [ ${i} -ne 0 ] ; then   # ** normal case **
-       #else                              # very first line
-
-
-	if [ ${rownum} -eq 1 ] ; then                            # first row
-	   decho "%%%%%%%%%%%%%%%%%% FIRST LOOP"
-	   tput bold || true
-           if [ "${1}" = "-k" ] ; then
-              printf "%s ${FMTSPC_VA}\n" "${LIN_HIGHEST_K}" 0x"${end_va}"
-           elif [ "${1}" = "-u" ] ; then
-  	      printf "%s ${FMTSPC_VA}\n" "${LIN_HIGHEST_U}" 0x${END_UVA}
-           fi
-	   color_reset
-	elif [ ${rownum} -eq ${totalrows} ] ; then               # last loop iteration
-	   decho "%%%%%%%%%%%%%%%%%% LAST LOOP"
-           if [ "$1" = "-k" -a ${IS_64_BIT} -eq 1 ] ; then
-              tput bold || true
-              printf "%s ${FMTSPC_VA}" "${LIN_LOWEST_K}" 0x${START_KVA}
-	      insert_arch_label ${START_KVA}
-	      color_reset
-	   else
-              printf "%s ${FMTSPC_VA}" "${LIN}" 0x${end_va}
-	      insert_arch_label ${end_va}
-	   fi
-	 #elif [ ${rownum} -gt 0 ] ; then   # ** normal case **
-	else                                                    #  ** normal case **
-	   #decho "%%%%%%%%%%%%%%%%%% NORMAL LOOP"
-
-		 #============ -l option: LOCATE region ! ======================
-           if [ ${LOC_LEN} -ne 0 -a "${segname}" = "${LOCATED_REGION_ENTRY}" ]; then
-	        show_located_region_in_map
-		let rownum=rownum+1
-		continue
-	   fi
-		
-		 #=== ** normal case ** ===
-#set -x
-           if [ "${segname}" != "${LOCATED_REGION_ENTRY}" ]; then
-               if [ ${flags} -eq 0 ] ; then
-		      printf "%s ${FMTSPC_VA}" "${LIN}" 0x"${end_va}"
-		elif  [ ${flags} -eq ${MAPFLAG_WITHIN_REGION} ] ; then
-		      printf "%s ${FMTSPC_VA}" "${LIN_WITHIN_REGION}" 0x"${end_va}"
-		fi
-	   fi
-
-	   if [ "$1" = "-k" ] ; then
-	      insert_arch_label ${end_va}
-	   else
-	      printf "\n"
-	   fi
-#set +x
-    fi
-
-	#--- Collate and print the details of the current mapping (segment)
-	# Eg.
-	# |<... Sparse Region ...> [ 14.73 MB] [----,0x0]                        |
-
-	# Print segment name
-	tmp1=$(printf "%s|%20s " $(${FG_MAPNAME}) ${segname})
-	local segname_nocolor=$(printf "|%20s " ${segname})
-
-	# Colour and Print segment *size* according to scale; in KB or MB or GB or TB or PB
-	tlen=0
-    if (( $(echo "${szKB} < 1024" |bc -l) )); then
-		# print KB only
-		tmp2=$(printf "%s [%4d KB" $(fg_darkgreen) ${szKB})
-		tmp2_nocolor=$(printf " [%4d KB" ${szKB})
-		tlen=${#tmp2_nocolor}
-    elif (( $(echo "${szKB} > 1024" |bc -l) )); then
-      if (( $(echo "${szMB} < 1024" |bc -l) )); then
-		# print MB only
-		tmp3=$(printf "%s[%7.2f MB" $(fg_navyblue) ${szMB})
-		tmp3_nocolor=$(printf "[%7.2f MB" ${szMB})
-		tlen=${#tmp3_nocolor}
-    elif (( $(echo "${szMB} > 1024" |bc -l) )); then
-#set -x
-      if (( $(echo "${szGB} < 1024" |bc -l) )); then
-		# print GB only
-		#-- TODO / RELOOK !!! bug here!
-		# ++ printf '%s%s[%7.2f GB%s' '' 8.03 ''
-		# environment: line 132: printf: : invalid number
-		# + tmp4='8.03[   0.00 GB'
-		#--
-		#tmp4=$(printf "%s%s[%7.2f GB%s" $(tput bold) $(fg_purple) ${szGB} $(color_reset))
-		tmp4=$(printf "[%7.2f GB" ${szGB})
-		tmp4_nocolor=$(printf "[%7.2f GB" ${szGB})
-		tlen=${#tmp4_nocolor}
-#set +x
-    elif (( $(echo "${szGB} > 1024" |bc -l) )); then
-      if (( $(echo "${szTB} < 1024" |bc -l) )); then
-		# print TB only
-		tmp5=$(printf "%s%s[%7.2f TB%s" $(tput bold) $(fg_red) ${szTB} $(color_reset))
-		tmp5_nocolor=$(printf "[%7.2f TB" ${szTB})
-		tlen=${#tmp5_nocolor}
-	else
-		# print PB only
-		tmp7=$(printf "%s%s[%9.2f PB%s" $(tput bold) $(fg_red) ${szPB} $(color_reset))
-		tmp7_nocolor=$(printf "[%9.2f PB" ${szPB})
-		tlen=${#tmp7_nocolor}
-       fi
-      fi
-	 fi
-	fi
-
-    # Mode field:
-	#  Userspace:
-	#   'mode' xxxy has two pieces of info:
-	#    - xxx is the mode (octal permissions / rwx style)
-	#    - y is either p or s, private or shared mapping
-	#   seperate them out in order to print them in diff colors, etc
-	#   (substr op: ${string:position:length} ; position starts @ 0)
-	#  kernel: it's just 'mode'
-	if [ "$1" = "-u" ] ; then
-	  local perms=$(echo ${mode:0:3})
-	  local maptype=$(echo ${mode:3:1})
-	else
-	  local perms=${mode}
-	fi
-
-	# mode (perms) + mapping type
-	#  print in bold red fg if:
-	#    mode == ---
-	#    mode violates the W^X principle, i.e., w and x set
-	local flag_null_perms=0 flag_wx_perms=0
-	if [ "${perms}" = "---" ]; then
-	   flag_null_perms=1
-	fi
-	echo "${perms}" | grep -q ".wx" && flag_wx_perms=1
-
-	if [ ${flag_null_perms} -eq 1 -o ${flag_wx_perms} -eq 1 ] ; then
-		tmp5a=$(printf "%s%s,%s%s" $(tput bold) $(fg_red) "${perms}" $(color_reset))
-	    if [ "$1" = "-u" ] ; then # addn comma only for userspace
-		   tmp5a="${tmp5a},"
-		else                      # to compensate, addn space for kernel
-		   tmp5a="${tmp5a} "
-		fi
-	else
-		tmp5a=$(printf "%s,%s%s" $(fg_black) "${perms}" $(color_reset))
-	    if [ "$1" = "-u" ] ; then # addn comma only for userspace
-		   tmp5a="${tmp5a},"
-		else                      # to compensate, addn space for kernel
-		   tmp5a="${tmp5a} "
-	    fi
-	fi
-	tmp5a_nocolor=$(printf ",%s," "${perms}")
-	len_perms=${#tmp5a_nocolor}
-
-	# userspace: mapping type and file offset
-	if [ "$1" = "-u" ] ; then
-	   tmp5b=$(printf "%s%s%s,%s" $(fg_blue) "${maptype}" $(fg_black) $(color_reset))
-	   tmp5b_nocolor=$(printf "%s," "${maptype}")
-	   len_maptype=${#tmp5b_nocolor}
-
-	   # file offset
-	   tmp5c=$(printf "%s0x%s%s" $(fg_black) "${offset}" $(color_reset))
-	   tmp5c_nocolor=$(printf "0x%s" "${offset}")
-	   len_offset=${#tmp5c_nocolor}
-	fi
-
-    # Calculate the strlen of the printed string, and thus calculate and print
-    # the appropriate number of spaces after it until the "|" close-box symbol.
-	# Final strlen value:
-	local segnmlen=${#segname_nocolor}
-	if [ ${segnmlen} -lt 20 ]; then
-		segnmlen=20  # as we do printf "|%20s"...
-	fi
-	if [ "$1" = "-u" ] ; then
-		let tlen=${segnmlen}+${tlen}+${len_perms}+${len_maptype}+${len_offset}
-	else
-		let tlen=${segnmlen}+${tlen}+${len_perms}
-	fi
-
-    if [ ${tlen} -lt ${#LIN} ] ; then
-       local spc_reqd=$((${linelen}-${tlen}))
-       tmp6=$(printf "]%${spc_reqd}s|\n" " ") 
-	       # print the required # of spaces and then the '|'
-    else
-		tmp6=$(printf "]")
-	fi
-    #decho "tlen=${tlen} spc_reqd=${spc_reqd}"
-
-	#================ The second actual print emitted!
-	# f.e:
-	# "|              [heap]  [ 132 KB,rw-,p,0x0]                             |"
-    echo "${tmp1}${tmp2}${tmp3}${tmp4}${tmp5}${tmp7}${tmp5a}${tmp5b}${tmp5c}${tmp6}"
-
-
-    #--- NEW CALC for SCALING
-    # Simplify: We base the 'height' of each segment on the number of digits
-    # in the segment size (in bytes)!
-    segscale=${#seg_sz}    # strlen(seg_sz)
-	# Exception to this check: if we're in a 'located region' (via -l option)
-    [ "${segname}" != "${LOCATED_REGION_ENTRY}" -a ${segscale} -lt 4 ] && {   # min seg size is 4096 bytes
-        echo "procmap:graphit(): fatal error, seg size < 4096 [segscale (# digits) <= 4] Aborting..."
-	    echo "Kindly report this as a bug, thanks!"
-	    exit 1
-    }
-    decho "seg_sz = ${seg_sz} segscale=${segscale}"
-
-    local box_height=0
-    # for segscale range [1-4]
-    # i.e. from 1-4 digits, i.e., 0 to 9999 bytes (ie. ~ 0 to 9.8 KB, single line
-    if [ ${segscale} -ge 1 -a ${segscale} -le 4 ]; then
-		box_height=0
-		# for segscale range [5-7]
-		# i.e. for 5 digits, i.e., ~  10 KB to  99 KB, 1 line box
-		# i.e. for 6 digits, i.e., ~ 100 KB to 999 KB ~= 1 MB, 2 line box
-		# i.e. for 7 digits, i.e., ~ 1 MB to 9.9 MB, 3 line box
-    elif [ ${segscale} -ge 5 -a ${segscale} -le 7 ]; then
-		let box_height=segscale-4
-    elif [ ${segscale} -ge 8 -a ${segscale} -le 13 ]; then
-		# for segscale >= 8 digits
-		let box_height=segscale-3
-    elif [ ${segscale} -ge 14 -a ${segscale} -le 16 ]; then
-		# for segscale >= 14 digits
-		# i.e. for 14 digits, i.e., from ~ 1 TB onwards, show an oversized ellipse box
-		box_height=16
-    else
-		# for segscale >= 16 digits
-		# i.e. for 16 digits, i.e., realistically, for the noncanonical 'hole' on 64-bit
-		# spanning close to 16 EB ! on x86_64
-		box_height=20
-    fi
-    #---
-
-    # draw the sides of the 'box'
-    [ ${box_height} -ge ${LARGE_SPACE} ] && {
-   	  oversized=1
-    }
-
-    #decho "box_height = ${box_height} oversized=${oversized}"
-	local x
-    for ((x=1; x<${box_height}; x++))
-    do
-   	  printf "%s\n" "${BOX_SIDES}"
-   	  if [ ${oversized} -eq 1 ] ; then
-        [ ${x} -eq $(((LIMIT_SCALE_SZ-4)/2)) ] && printf "%s\n" "${ELLIPSE_LIN}"
-   	  fi
-    done
-
-    oversized=0
-	let rownum=rownum+1
-done
-
-# address space: the K-U boundary! on 32-bit, display both the start kva and
-# the 'end uva' virt addresses; on 64-bit, the noncanonical sparse region code
-# takes care of printing it correctly...
-tput bold
-if [ "${1}" = "-k" ] ; then
-	[ ${IS_64_BIT} -eq 0 ] && {
-	   printf "%s ${FMTSPC_VA}" "${LIN_LOWEST_K}" 0x${START_KVA}
-	   echo
-	}
-	[ ${SHOW_USERSPACE} -eq 0 ] && {
-	  if [ ${IS_64_BIT} -eq 0 ]; then
-	     color_reset; return
-	  fi
-	  printf "%s ${FMTSPC_VA}\n" "${LIN_HIGHEST_U}" 0x${END_UVA}
-	}
+   FILE_TO_PARSE=/tmp/${name}/pmkfinal
+   afile=${KANNOTFILE}
 fi
-color_reset
+[ -s "${afile}" ] || afile=/dev/null
+
+awk -F"${gDELIM}" -v space=${1:1:1} -v totalrows=$(wc -l < ${FILE_TO_PARSE}) \
+    -v vaw=$((10#${FMTSPC_VA//[^0-9]/})) -v is64=${IS_64_BIT} -v show_user=${SHOW_USERSPACE} \
+    -v end_uva=${END_UVA} -v start_kva=${START_KVA} -v archfile=${ARCHFILE} -v annotfile=${afile} \
+    -v loc_len=${LOC_LEN} -v loc_start=${LOC_STARTADDR:-0} -v loc_entry="${LOCATED_REGION_ENTRY}" \
+    -v mark="${MARK_LOCATION}" -v within=${MAPFLAG_WITHIN_REGION} \
+    -v large_space=${LARGE_SPACE} -v limit_scale=${LIMIT_SCALE_SZ} \
+    -v LIN_HK="${LIN_HIGHEST_K}" -v LIN_LK="${LIN_LOWEST_K}" -v LIN_HU="${LIN_HIGHEST_U}" \
+    -v LIN_LU="${LIN_LOWEST_U}" -v LIN="${LIN}" -v LIN_WR="${LIN_WITHIN_REGION}" \
+    -v ELLIPSE="${ELLIPSE_LIN}" -v SIDES="${BOX_SIDES}" \
+    -v B="${TC_BOLD}" -v R="${TC_RESET}" -v C_MAP="${TC_MAPNAME}" -v C_KVAR="${TC_KVAR}" \
+    -v C_KB="${TC_KB}" -v C_MB="${TC_MB}" -v C_RED="${TC_RED}" -v C_BLACK="${TC_BLACK}" \
+    -v C_BLUE="${TC_BLUE}" '
+# A va, as FMTSPC_VA (%016lx or %08lx) shows it
+function va(h) {
+  h = tolower(h) ; sub(/^0x/, "", h) ; sub(/^0+/, "", h)
+  if (h == "") h = "0"
+  while (length(h) < vaw) h = "0" h
+  return h
+}
+# If the va matches entries in the ARCHFILE, their label(s); f.e. 0x.... <-- PAGE_OFFSET
+# The values can overlap! F.e on some Aarch32 with a 2:2 (or 3:1) VM split,
+# both PAGE_OFFSET and MODULES_END coincide at 0x80000000 (or 0xc0000000);
+# Ditto for MODULES_VADDR and START_KVA
+# TODO: x86_64: buggy when -k option passed, ok when both VASes are displayed
+function arch_label(v,   i, n, l, lbl) {
+  sub(/^0x/, "", v)
+  n = 0 ; lbl = ""
+  for (i = 1; i <= narch; i++) {
+    if (!index(archln[i], v)) continue
+    l = archln[i] ; sub(/=.*/, "", l)
+    lbl = (n++ ? lbl "/" : "") l
+  }
+  if (n == 0) return "\n"
+  return B C_KVAR "  <-- " lbl "\n" R
+}
+# The segment size, in the unit it is displayed in (KB, MB, GB, TB, PB);
+# each unit is truncated to 2 decimal places and is only calculated when the
+# previous one is > 1024. Double-precision numbers are plenty for the
+# (approximate) display of even the largest - 16 EB - region.
+function trunc2(x) { return int(x*100 + 0.000001)/100 }
+function size_str(sz,   kb, mb, gb, tb, pb) {
+  kb = int(sz/1024) ; mb = gb = tb = pb = 0
+  if (kb >= 1024) mb = trunc2(kb/1024)
+  if (mb > 1024) gb = trunc2(mb/1024)
+  if (gb > 1024) tb = trunc2(gb/1024)
+  if (tb > 1024) pb = trunc2(tb/1024)
+  if (kb < 1024) { s = sprintf(" [%4d KB", kb) ; return C_KB s }
+  if (kb == 1024) { s = "" ; return "" }
+  if (mb < 1024) { s = sprintf("[%7.2f MB", mb) ; return C_MB s }
+  if (mb == 1024) { s = "" ; return "" }
+  if (gb < 1024) { s = sprintf("[%7.2f GB", gb) ; return s }
+  if (gb == 1024) { s = "" ; return "" }
+  if (tb < 1024) { s = sprintf("[%7.2f TB", tb) ; return B C_RED s R }
+  s = sprintf("[%9.2f PB", pb) ; return B C_RED s R
+}
+BEGIN {
+  while ((getline ln < archfile) > 0) archln[++narch] = ln
+  close(archfile)
+  while ((getline ln < annotfile) > 0) {
+    k = ln ; sub(/,.*/, "", k) ; v = substr(ln, length(k) + 2)
+    if (v == "") continue
+    if (k in annot) annot[k] = annot[k] "\n" v
+    else annot[k] = v
+  }
+  close(annotfile)
+  linelen = length(LIN) - 2
+}
+{
+  name = $1 ; sz = $2 ; sva = $3 ; eva = $4 ; mode = $5 ; flags = $6
+  if (space == "u") { off = flags ; flags = 0 }
+  if (sz == "") { done = 1 ; exit }   # invalid mapping size
+  last_sva = sva
+
+  #--- the horizontal line with the end va at the end of it
+  # f.e.
+  # +----------------------------------------------------------------------+ 000055681263b000
+  if (NR == 1) {                                          # first row
+     out = B sprintf("%s %s\n", (space == "k") ? LIN_HK : LIN_HU, va((space == "k") ? eva : end_uva)) R
+  } else if (NR == totalrows) {                           # last row
+     if (space == "k" && is64 == 1)
+        out = B LIN_LK " " va(start_kva) arch_label(start_kva) R
+     else
+        out = LIN " " va(eva) arch_label(eva)
+  } else {                                                # ** normal case **
+     #--- -l option: LOCATE region !
+     # TODO: BUG: if LOC_STARTADDR is same as a segment addr, it is printed twice
+     if (loc_len != 0 && name == loc_entry) {
+        pad = (is64 == 1) ? "                          " : "                              "
+        printf("%s%s|%s%s %s%s|\n%s", B, C_RED, pad, mark, va(loc_start), pad, R)
+        next
+     }
+     out = ""
+     if (name != loc_entry) {
+        if (flags == 0) out = LIN " " va(eva)
+        else if (flags == within) out = LIN_WR " " va(eva)
+     }
+     out = out ((space == "k") ? arch_label(eva) : "\n")
+  }
 
-# userspace: last line, the zero-th virt address; always:
-#+----------------------------------------------------------------------+ 0000000000000000
-if [ "$1" = "-u" ] ; then
-   tput bold
-   printf "%s ${FMTSPC_VA}\n" "${LIN_LOWEST_U}" ${start_va}
-   color_reset
-fi
+  #--- the details of the mapping (segment)
+  # f.e.
+  # |<... Sparse Region ...> [ 14.73 MB] [----,0x0]                        |
+  # Userspace: the mode xxxy is the permissions (rwx style) and p or s,
+  # private or shared mapping; shown in diff colors. Permissions are shown in
+  # bold red if they are --- or they violate the W^X principle (w and x set)
+  nm = sprintf("|%20s ", name)
+  line = C_MAP nm size_str(sz)
+  tlen = length(nm) + length(s)
+  perms = (space == "u") ? substr(mode, 1, 3) : mode
+  if (perms == "---" || perms ~ /.wx/)
+     line = line B C_RED "," perms R
+  else
+     line = line C_BLACK "," perms R
+  tlen += length(perms) + 2
+  if (space == "u") {
+     maptype = substr(mode, 4, 1)
+     line = line "," C_BLUE maptype C_BLACK "," R C_BLACK "0x" off R
+     tlen += length(maptype) + 1 + length(off) + 2
+  } else
+     line = line " "
+  # pad with the appropriate number of spaces upto the "|" close-box symbol
+  if (tlen < length(LIN))
+     line = line "]" sprintf("%" (linelen - tlen) "s|", " ")
+  else
+     line = line "]"
+  out = out line "\n"
+
+  # Annotations, if any; they take up (some of) the box sides lines below
+  nannot = 0
+  if (sva in annot) {
+     nannot = split(annot[sva], al, "\n")
+     for (i = 1; i <= nannot; i++)
+        out = out sprintf("|   %-" (linelen-3) "." (linelen-3) "s|\n", al[i])
+  }
+  printf("%s", out)
+
+  #--- Scaling: we base the height of each segment box on the number of digits
+  # in the segment size (in bytes)
+  segscale = length(sz)
+  if (name != loc_entry && segscale < 4) {   # min seg size is 4096 bytes
+     print "procmap:graphit(): fatal error, seg size < 4096 [segscale (# digits) <= 4] Aborting..."
+     print "Kindly report this as a bug, thanks!"
+     done = fatal = 1 ; exit 1
+  }
+  if (segscale <= 4) box_height = 0         # upto 9999 bytes: single line
+  else if (segscale <= 7) box_height = segscale - 4   # ~ 10 KB to 9.9 MB: 1 to 3 lines
+  else if (segscale <= 13) box_height = segscale - 3
+  else if (segscale <= 16) box_height = 16  # from ~ 1 TB onwards, an oversized ellipse box
+  else box_height = 20                      # realistically, the 64-bit noncanonical hole
+  oversized = (box_height >= large_space)
+
+  # draw the sides of the box
+  for (x = 1 + nannot; x < box_height; x++) {
+     print SIDES
+     if (oversized && x == int((limit_scale - 4)/2)) print ELLIPSE
+  }
+}
+END {
+  if (done) exit fatal
+  # address space: the K-U boundary! on 32-bit, display both the start kva and
+  # the end uva virt addresses; on 64-bit, the noncanonical sparse region code
+  # takes care of printing it correctly...
+  printf("%s", B)
+  if (space == "k") {
+     if (is64 == 0) printf("%s %s\n", LIN_LK, va(start_kva))
+     if (show_user == 0) {
+        if (is64 == 0) { printf("%s", R) ; exit }
+        printf("%s %s\n", LIN_HU, va(end_uva))
+     }
+  }
+  printf("%s", R)
+  # userspace: last line, the zero-th virt address; always:
+  #+----------------------------------------------------------------------+ 0000000000000000
+  if (space == "u") printf("%s%s %s\n%s", B, LIN_LU, va(last_sva), R)
+}' ${FILE_TO_PARSE} || exit 1
 } # end graphit()
@@ -0,0 +1,80 @@
+/*
+ * pmjsonl.c
+ ***************************************************************
+ * Brief Description:
+ * A small example of using libprocmap (procmap_jsonl.h): list the segments
+ * of a procmap --jsonl stream - a file, stdin, or procmap run on a process -
+ * one per line, followed by the totals.
+ *
+ * Usage: pmjsonl FILE|-
+ *        pmjsonl -p PID [path-to-procmap]
+ ***************************************************************
+ * (c) Kaiwan N Billimoria, 2020
+ * (c) kaiwanTECH
+ * License: MIT
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "procmap_jsonl.h"
+
+int main(int argc, char **argv)
+{
+	struct procmap_iter *it;
+	struct procmap_rec rec;
+	unsigned long long nseg = 0, mapped = 0, rss = 0;
+	int ret, status;
+
+	if (argc >= 3 && !strcmp(argv[1], "-p"))
+		it = procmap_open_pid(atoi(argv[2]), argc > 3 ? argv[3] : NULL, NULL);
+	else if (argc == 2)
+		it = procmap_open_file(argv[1]);
+	else {
+		fprintf(stderr, "Usage: %s FILE|-\n"
+			"       %s -p PID [path-to-procmap]\n", argv[0], argv[0]);
+		return 1;
+	}
+	if (!it) {
+		perror("pmjsonl: open");
+		return 1;
+	}
+
+	while ((ret = procmap_next(it, &rec)) > 0) {
+		switch (rec.type) {
+		case PROCMAP_REC_PROCESS:
+			printf("pid %s (%s) %s\n", procmap_get(&rec, "pid"),
+			       procmap_get(&rec, "comm"), procmap_get(&rec, "exe"));
+			break;
+		case PROCMAP_REC_SEGMENT:
+			if (rec.seg.kind == PROCMAP_KIND_SPARSE)
+				break;
+			printf("%c %016llx-%016llx %-4s %12llu %s",
+			       rec.seg.space == PROCMAP_SPACE_KERNEL ? 'K' : 'U',
+			       rec.seg.start, rec.seg.end, rec.seg.perms,
+			       rec.seg.size, rec.seg.name);
+			if (rec.seg.has_smaps) {
+				printf("  [rss %llu KB]", rec.seg.rss_kb);
+				rss += rec.seg.rss_kb;
+			}
+			printf("\n");
+			nseg++;
+			mapped += rec.seg.size;
+			break;
+		case PROCMAP_REC_FRAG:
+			printf("# vmas %llu, holes %llu, hole histogram %s\n",
+			       procmap_get_ull(&rec, "nr_vmas", 0),
+			       procmap_get_ull(&rec, "nr_holes", 0),
+			       procmap_get(&rec, "hole_hist"));
+			break;
+		default:
+			break;
+		}
+	}
+	if (ret < 0)
+		perror("pmjsonl: read");
+	printf("# %llu segments, %llu bytes, rss %llu KB\n", nseg, mapped, rss);
+	status = procmap_close(it);
+	if (status)
+		fprintf(stderr, "pmjsonl: procmap exited with status %d\n", status);
+	return (ret < 0 || status) ? 1 : 0;
+}
@@ -0,0 +1,423 @@
+/*
+ * procmap_jsonl.c
+ ***************************************************************
+ * Brief Description:
+ * libprocmap: an iterator over procmap's JSON Lines output (--jsonl).
+ * See procmap_jsonl.h.
+ *
+ * procmap writes one flat JSON object per line (the one nested value being
+ * the frag record's hole_hist array), so a line's parsed in place: strings
+ * are unescaped and every value NUL terminated within the line buffer, the
+ * fields array pointing into it. Nothing's kept across lines.
+ ***************************************************************
+ * (c) Kaiwan N Billimoria, 2020
+ * (c) kaiwanTECH
+ * License: MIT
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "procmap_jsonl.h"
+
+/* The fd procmap's given to write the stream to, as /dev/fd/N; one the
+ * procmap scripts don't use themselves.
+ */
+#define PROCMAP_OUTFD	9
+
+struct procmap_iter {
+	FILE *fp;
+	int own_fp;		/* we opened it, so close it */
+	pid_t child;		/* procmap_open_pid(): procmap's pid, else 0 */
+	char *line;
+	size_t linesz;
+	struct procmap_field *fields;
+	int maxfields;
+};
+
+static struct procmap_iter *iter_new(FILE *fp, int own_fp, pid_t child)
+{
+	struct procmap_iter *it = calloc(1, sizeof(*it));
+
+	if (!it)
+		return NULL;
+	it->fp = fp;
+	it->own_fp = own_fp;
+	it->child = child;
+	return it;
+}
+
+struct procmap_iter *procmap_open_stream(FILE *fp)
+{
+	if (!fp) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return iter_new(fp, 0, 0);
+}
+
+struct procmap_iter *procmap_open_file(const char *path)
+{
+	struct procmap_iter *it;
+	FILE *fp;
+
+	if (!strcmp(path, "-"))
+		return procmap_open_stream(stdin);
+	fp = fopen(path, "r");
+	if (!fp)
+		return NULL;
+	it = iter_new(fp, 1, 0);
+	if (!it)
+		fclose(fp);
+	return it;
+}
+
+struct procmap_iter *procmap_open_pid(pid_t pid, const char *procmap,
+				      char *const argv[])
+{
+	char pidopt[32], outopt[32];
+	const char **args;
+	struct procmap_iter *it;
+	int fds[2], n = 0, i, nul;
+	FILE *fp;
+	pid_t child;
+
+	if (pid <= 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (!procmap)
+		procmap = "procmap";
+	for (i = 0; argv && argv[i]; i++)
+		;
+	args = calloc(i + 4, sizeof(*args));
+	if (!args)
+		return NULL;
+	snprintf(pidopt, sizeof(pidopt), "--pid=%d", (int)pid);
+	snprintf(outopt, sizeof(outopt), "--jsonl=/dev/fd/%d", PROCMAP_OUTFD);
+	args[n++] = procmap;
+	args[n++] = pidopt;
+	args[n++] = outopt;
+	for (i = 0; argv && argv[i]; i++)
+		args[n++] = argv[i];
+	args[n] = NULL;
+
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		free(args);
+		return NULL;
+	}
+	child = fork();
+	if (child < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		free(args);
+		return NULL;
+	}
+	if (child == 0) {
+		/* procmap's terminal output is of no use here */
+		nul = open("/dev/null", O_RDWR);
+		if (nul < 0 || dup2(nul, 0) < 0 || dup2(nul, 1) < 0 ||
+		    dup2(nul, 2) < 0 || dup2(fds[1], PROCMAP_OUTFD) < 0)
+			_exit(127);
+		execvp(procmap, (char *const *)args);
+		_exit(127);
+	}
+	free(args);
+	close(fds[1]);
+	fp = fdopen(fds[0], "r");
+	if (!fp) {
+		close(fds[0]);
+		waitpid(child, NULL, 0);
+		return NULL;
+	}
+	it = iter_new(fp, 1, child);
+	if (!it) {
+		fclose(fp);
+		waitpid(child, NULL, 0);
+	}
+	return it;
+}
+
+static char *skip_ws(char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+		p++;
+	return p;
+}
+
+static int hexval(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* Unescape the string starting just past it's opening quote at p, in place;
+ * returns the char just past the closing quote, or NULL if it isn't closed.
+ * Non-ASCII \u escapes become '?' (procmap doesn't emit any).
+ */
+static char *parse_str(char *p)
+{
+	char *d = p;
+	int i, u;
+
+	while (*p && *p != '"') {
+		if (*p != '\\') {
+			*d++ = *p++;
+			continue;
+		}
+		switch (*++p) {
+		case 'b': *d++ = '\b'; break;
+		case 'f': *d++ = '\f'; break;
+		case 'n': *d++ = '\n'; break;
+		case 'r': *d++ = '\r'; break;
+		case 't': *d++ = '\t'; break;
+		case 'u':
+			for (i = 1, u = 0; i <= 4; i++) {
+				if (hexval(p[i]) < 0)
+					return NULL;
+				u = u * 16 + hexval(p[i]);
+			}
+			*d++ = (u > 0 && u < 0x80) ? u : '?';
+			p += 4;
+			break;
+		case '"':
+		case '\\':
+		case '/':
+			*d++ = *p;
+			break;
+		default:
+			return NULL;
+		}
+		p++;
+	}
+	if (*p != '"')
+		return NULL;
+	*d = '\0';
+	return p + 1;
+}
+
+/* Skip over the array or object at p (raw; strings within it respected);
+ * returns the char just past it's closing bracket, or NULL.
+ */
+static char *skip_nested(char *p)
+{
+	int depth = 0;
+
+	for (; *p; p++) {
+		if (*p == '"') {
+			for (p++; *p && *p != '"'; p++)
+				if (*p == '\\' && !*++p)
+					return NULL;
+			if (!*p)
+				return NULL;
+		} else if (*p == '[' || *p == '{') {
+			depth++;
+		} else if (*p == ']' || *p == '}') {
+			if (--depth == 0)
+				return p + 1;
+		}
+	}
+	return NULL;
+}
+
+static int add_field(struct procmap_iter *it, int n, const char *key,
+		     const char *val, int is_str)
+{
+	struct procmap_field *f;
+
+	if (n == it->maxfields) {
+		f = realloc(it->fields, (it->maxfields + 16) * sizeof(*f));
+		if (!f)
+			return -1;
+		it->fields = f;
+		it->maxfields += 16;
+	}
+	it->fields[n].key = key;
+	it->fields[n].val = val;
+	it->fields[n].is_str = is_str;
+	return 0;
+}
+
+/* Parse the object at p ('{') into it->fields; returns the # of fields, or
+ * -1 (errno set).
+ */
+static int parse_obj(struct procmap_iter *it, char *p)
+{
+	char *key, *val, *end, c;
+	int n = 0, is_str;
+
+	p = skip_ws(p + 1);
+	if (*p == '}')
+		return 0;
+	for (;;) {
+		if (*p != '"')
+			goto bad;
+		key = p + 1;
+		p = parse_str(key);
+		if (!p)
+			goto bad;
+		p = skip_ws(p);
+		if (*p != ':')
+			goto bad;
+		p = skip_ws(p + 1);
+		val = p;
+		is_str = 0;
+		if (*p == '"') {
+			val = p + 1;
+			end = parse_str(val);
+			is_str = 1;
+		} else if (*p == '[' || *p == '{') {
+			end = skip_nested(p);
+		} else {
+			for (end = p; *end && !strchr(",} \t\r\n", *end); end++)
+				;
+			if (end == p)
+				end = NULL;
+		}
+		if (!end)
+			goto bad;
+		/* terminate the value in place, keeping the delimiter that was there */
+		c = *end;
+		if (!is_str)
+			*end = '\0';
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+			end = skip_ws(end + 1);
+			c = *end;
+		}
+		if (add_field(it, n++, key, val, is_str) < 0)
+			return -1;
+		if (c == '}')
+			return n;
+		if (c != ',')
+			goto bad;
+		p = skip_ws(end + 1);
+	}
+bad:
+	errno = EBADMSG;
+	return -1;
+}
+
+const char *procmap_get(const struct procmap_rec *rec, const char *key)
+{
+	int i;
+
+	for (i = 0; i < rec->nfields; i++)
+		if (!strcmp(rec->fields[i].key, key))
+			return rec->fields[i].val;
+	return NULL;
+}
+
+unsigned long long procmap_get_ull(const struct procmap_rec *rec,
+				   const char *key, unsigned long long def)
+{
+	const char *v = procmap_get(rec, key);
+
+	if (!v || !*v)
+		return def;
+	return strtoull(v, NULL, 0);
+}
+
+static void decode_segment(struct procmap_rec *rec)
+{
+	struct procmap_segment *s = &rec->seg;
+	const char *v;
+
+	v = procmap_get(rec, "space");
+	s->space = (v && !strcmp(v, "kernel")) ? PROCMAP_SPACE_KERNEL
+					       : PROCMAP_SPACE_USER;
+	v = procmap_get(rec, "kind");
+	if (v && !strcmp(v, "sparse"))
+		s->kind = PROCMAP_KIND_SPARSE;
+	else if (v && !strcmp(v, "nulltrap"))
+		s->kind = PROCMAP_KIND_NULLTRAP;
+	else
+		s->kind = PROCMAP_KIND_MAPPING;
+	s->name = procmap_get(rec, "name");
+	if (!s->name)
+		s->name = "";
+	s->perms = procmap_get(rec, "perms");
+	if (!s->perms)
+		s->perms = "";
+	s->start = procmap_get_ull(rec, "start", 0);
+	s->end = procmap_get_ull(rec, "end", 0);
+	s->size = procmap_get_ull(rec, "size", s->end - s->start);
+	s->offset = procmap_get_ull(rec, "offset", 0);
+	s->has_smaps = procmap_get(rec, "rss_kb") != NULL;
+	s->rss_kb = procmap_get_ull(rec, "rss_kb", 0);
+	s->pss_kb = procmap_get_ull(rec, "pss_kb", 0);
+	s->swap_kb = procmap_get_ull(rec, "swap_kb", 0);
+	s->thp_kb = procmap_get_ull(rec, "thp_kb", 0);
+	s->locked_kb = procmap_get_ull(rec, "locked_kb", 0);
+}
+
+int procmap_next(struct procmap_iter *it, struct procmap_rec *rec)
+{
+	const char *type;
+	char *p;
+	int n;
+
+	memset(rec, 0, sizeof(*rec));
+	for (;;) {
+		errno = 0;
+		if (getline(&it->line, &it->linesz, it->fp) < 0)
+			return errno ? -1 : 0;
+		/* skip anything that isn't a record (f.e. terminal output, that
+		 * may well have escape sequences before the '{')
+		 */
+		p = strchr(it->line, '{');
+		if (p)
+			break;
+	}
+	n = parse_obj(it, p);
+	if (n < 0)
+		return -1;
+	rec->nfields = n;
+	rec->fields = it->fields;
+
+	type = procmap_get(rec, "type");
+	if (!type)
+		rec->type = PROCMAP_REC_UNKNOWN;
+	else if (!strcmp(type, "segment"))
+		rec->type = PROCMAP_REC_SEGMENT;
+	else if (!strcmp(type, "process"))
+		rec->type = PROCMAP_REC_PROCESS;
+	else if (!strcmp(type, "stats"))
+		rec->type = PROCMAP_REC_STATS;
+	else if (!strcmp(type, "frag"))
+		rec->type = PROCMAP_REC_FRAG;
+	else
+		rec->type = PROCMAP_REC_UNKNOWN;
+	if (rec->type == PROCMAP_REC_SEGMENT)
+		decode_segment(rec);
+	return 1;
+}
+
+int procmap_close(struct procmap_iter *it)
+{
+	int ret = 0, status;
+	pid_t w;
+
+	if (!it)
+		return -1;
+	if (it->own_fp)
+		fclose(it->fp);
+	if (it->child > 0) {
+		/* (if we stopped early, procmap gets a SIGPIPE and is done) */
+		while ((w = waitpid(it->child, &status, 0)) < 0 && errno == EINTR)
+			;
+		ret = (w == it->child && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+	}
+	free(it->line);
+	free(it->fields);
+	free(it);
+	return ret;
+}
@@ -0,0 +1,120 @@
+/*
+ * procmap_jsonl.h
+ ***************************************************************
+ * Brief Description:
+ * libprocmap: read procmap's machine readable output - the JSON Lines stream
+ * that 'procmap --jsonl=FILE' writes (see the README) - from C/C++, as an
+ * iterator over it's records.
+ *
+ *	struct procmap_iter *it = procmap_open_pid(pid, NULL, NULL);
+ *	struct procmap_rec rec;
+ *
+ *	while (procmap_next(it, &rec) > 0)
+ *		if (rec.type == PROCMAP_REC_SEGMENT)
+ *			printf("%llx-%llx %s\n", rec.seg.start, rec.seg.end, rec.seg.name);
+ *	procmap_close(it);
+ *
+ * The stream's parsed a line at a time, in constant memory, so the reader
+ * can be a FIFO that procmap's still writing. Lines that aren't a JSON
+ * object (f.e. procmap's terminal output, when the stream's on it's stdout)
+ * are skipped.
+ ***************************************************************
+ * (c) Kaiwan N Billimoria, 2020
+ * (c) kaiwanTECH
+ * License: MIT
+ */
+#ifndef __PROCMAP_JSONL_H__
+#define __PROCMAP_JSONL_H__
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum procmap_rec_type {
+	PROCMAP_REC_UNKNOWN = 0,
+	PROCMAP_REC_PROCESS,
+	PROCMAP_REC_SEGMENT,
+	PROCMAP_REC_STATS,
+	PROCMAP_REC_FRAG,
+};
+
+enum procmap_space {
+	PROCMAP_SPACE_KERNEL = 0,
+	PROCMAP_SPACE_USER,
+};
+
+enum procmap_kind {
+	PROCMAP_KIND_MAPPING = 0,
+	PROCMAP_KIND_SPARSE,	/* unmapped region (incl. the non-canonical hole) */
+	PROCMAP_KIND_NULLTRAP,
+};
+
+/* A key/value pair of a record; values as they appear in the JSON, except
+ * that strings are unquoted and unescaped. Arrays (the frag record's
+ * hole_hist) are left as their raw JSON text.
+ */
+struct procmap_field {
+	const char *key;
+	const char *val;
+	int is_str;
+};
+
+/* A 'segment' record, decoded */
+struct procmap_segment {
+	enum procmap_space space;
+	enum procmap_kind kind;
+	const char *name;
+	const char *perms;
+	unsigned long long start, end;	/* [start, end) */
+	unsigned long long size;	/* bytes */
+	unsigned long long offset;	/* file offset; user mappings only */
+	int has_smaps;			/* the *_kb fields are valid */
+	unsigned long long rss_kb, pss_kb, swap_kb, thp_kb, locked_kb;
+};
+
+/* A record. All pointers in it point into the iterator's line buffer and are
+ * valid until the next procmap_next() or procmap_close() on it.
+ */
+struct procmap_rec {
+	enum procmap_rec_type type;
+	struct procmap_segment seg;	/* valid if type == PROCMAP_REC_SEGMENT */
+	int nfields;
+	const struct procmap_field *fields;	/* all of them, in order */
+};
+
+struct procmap_iter;
+
+/* Iterate over the JSONL stream on fp; fp isn't closed by procmap_close() */
+struct procmap_iter *procmap_open_stream(FILE *fp);
+/* Iterate over the JSONL file path ("-" for stdin) */
+struct procmap_iter *procmap_open_file(const char *path);
+/* Run procmap on process pid and iterate over it's output. procmap is the
+ * path to the procmap script (NULL: "procmap", looked up in the PATH); argv
+ * is a NULL terminated list of extra options (f.e. "--only-user"), or NULL.
+ */
+struct procmap_iter *procmap_open_pid(pid_t pid, const char *procmap,
+				      char *const argv[]);
+
+/* Read the next record into rec. Returns 1 on success, 0 at the end of the
+ * stream and -1 on error (errno set; EBADMSG for a malformed record).
+ */
+int procmap_next(struct procmap_iter *it, struct procmap_rec *rec);
+
+/* The value of field key of rec, or NULL if it hasn't got one */
+const char *procmap_get(const struct procmap_rec *rec, const char *key);
+/* ... as an integer (hex strings, "0x...", too); def if it's absent */
+unsigned long long procmap_get_ull(const struct procmap_rec *rec,
+				   const char *key, unsigned long long def);
+
+/* Free the iterator. Returns 0, or - for procmap_open_pid() - procmap's exit
+ * status (-1 if it couldn't be had).
+ */
+int procmap_close(struct procmap_iter *it);
+
+#ifdef __cplusplus
+}
+#endif
+#endif	/* __PROCMAP_JSONL_H__ */
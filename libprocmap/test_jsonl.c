@@ -0,0 +1,123 @@
+/*
+ * test_jsonl.c
+ ***************************************************************
+ * Brief Description:
+ * Unit test for libprocmap's JSONL iterator: parse a sample stream (in the
+ * format jsonl_export() writes, with some terminal noise mixed in) and check
+ * every record decodes as expected. Run via 'make test'.
+ ***************************************************************
+ * (c) Kaiwan N Billimoria, 2020
+ * (c) kaiwanTECH
+ * License: MIT
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "procmap_jsonl.h"
+
+static int fails;
+
+#define CHECK(cond) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: FAIL: %s\n", __FILE__, __LINE__, #cond); \
+		fails++;						\
+	}								\
+} while (0)
+
+static const char sample[] =
+	"\033[33m[i] will write the memory map to /dev/stdout (JSON Lines)\n"
+	"\033(B\033[m{\"type\":\"process\",\"pid\":6077,\"comm\":\"put\",\"exe\":\"/tmp/put\",\"arch\":\"x86_64\",\"page_size\":4096,\"time\":\"2026-10-17T02:32:59+0000\"}\n"
+	"{\"type\":\"segment\",\"space\":\"kernel\",\"kind\":\"mapping\",\"name\":\"fixmap region\",\"start\":\"0xffffffffff579000\",\"end\":\"0xffffffffff7ff000\",\"size\":2646016,\"perms\":\"r--\"}\n"
+	"{\"type\":\"segment\",\"space\":\"user\",\"kind\":\"mapping\",\"name\":\"/tmp/a \\\"b\\\"\\\\c\\td\",\"start\":\"0x7f0000001000\",\"end\":\"0x7f0000003000\",\"size\":8192,\"perms\":\"r-xp\",\"offset\":\"0x1000\",\"rss_kb\":8,\"pss_kb\":4,\"swap_kb\":0,\"thp_kb\":0,\"locked_kb\":0}\n"
+	"\n"
+	"{ \"type\" : \"segment\" , \"space\":\"user\",\"kind\":\"sparse\",\"name\":\"<... Sparse Region ...>\",\"start\":\"0x1000\",\"end\":\"0x7f0000001000\",\"size\":139637976346624,\"perms\":\"---\" }\n"
+	"{\"type\":\"segment\",\"space\":\"user\",\"kind\":\"nulltrap\",\"name\":\"< NULL trap >\",\"start\":\"0x0\",\"end\":\"0x1000\",\"size\":4096,\"perms\":\"---\"}\n"
+	"{\"type\":\"stats\",\"kernel_vas_size\":140737488355328,\"user_vas_size\":140737488351232,\"nr_vmas\":2,\"mapped_size\":8192,\"nr_sparse\":1,\"sparse_size\":139637976346624}\n"
+	"{\"type\":\"frag\",\"nr_vmas\":2,\"nr_holes\":1,\"largest_hole_start\":\"0x1000\",\"hole_hist\":[{\"lt\":\"64K\",\"count\":0,\"size\":0},{\"lt\":\"1G\",\"count\":1,\"size\":4096}]}\n"
+	"{\"type\":\"segment\",\"name\":\"unterminated}\n";
+
+int main(void)
+{
+	struct procmap_iter *it;
+	struct procmap_rec rec;
+	FILE *fp;
+
+	fp = fmemopen((void *)sample, sizeof(sample) - 1, "r");
+	CHECK(fp != NULL);
+	if (!fp)
+		return 1;
+	it = procmap_open_stream(fp);
+	CHECK(it != NULL);
+	if (!it)
+		return 1;
+
+	/* the process record, past the terminal noise */
+	CHECK(procmap_next(it, &rec) == 1);
+	CHECK(rec.type == PROCMAP_REC_PROCESS);
+	CHECK(rec.nfields == 7);
+	CHECK(procmap_get_ull(&rec, "pid", 0) == 6077);
+	CHECK(!strcmp(procmap_get(&rec, "comm"), "put"));
+	CHECK(procmap_get_ull(&rec, "page_size", 0) == 4096);
+	CHECK(procmap_get(&rec, "nosuchkey") == NULL);
+
+	CHECK(procmap_next(it, &rec) == 1);
+	CHECK(rec.type == PROCMAP_REC_SEGMENT);
+	CHECK(rec.seg.space == PROCMAP_SPACE_KERNEL);
+	CHECK(rec.seg.kind == PROCMAP_KIND_MAPPING);
+	CHECK(!strcmp(rec.seg.name, "fixmap region"));
+	CHECK(rec.seg.start == 0xffffffffff579000ULL);
+	CHECK(rec.seg.end == 0xffffffffff7ff000ULL);
+	CHECK(rec.seg.size == 2646016);
+	CHECK(!strcmp(rec.seg.perms, "r--"));
+	CHECK(!rec.seg.has_smaps);
+
+	/* escapes in the name; the smaps fields */
+	CHECK(procmap_next(it, &rec) == 1);
+	CHECK(rec.type == PROCMAP_REC_SEGMENT);
+	CHECK(rec.seg.space == PROCMAP_SPACE_USER);
+	CHECK(!strcmp(rec.seg.name, "/tmp/a \"b\"\\c\td"));
+	CHECK(rec.seg.offset == 0x1000);
+	CHECK(rec.seg.has_smaps);
+	CHECK(rec.seg.rss_kb == 8 && rec.seg.pss_kb == 4);
+
+	/* the blank line's skipped; whitespace within the object's fine */
+	CHECK(procmap_next(it, &rec) == 1);
+	CHECK(rec.type == PROCMAP_REC_SEGMENT);
+	CHECK(rec.seg.kind == PROCMAP_KIND_SPARSE);
+	CHECK(rec.seg.size == 139637976346624ULL);
+	CHECK(!strcmp(rec.seg.perms, "---"));
+
+	CHECK(procmap_next(it, &rec) == 1);
+	CHECK(rec.seg.kind == PROCMAP_KIND_NULLTRAP);
+	CHECK(rec.seg.start == 0 && rec.seg.end == 0x1000);
+
+	CHECK(procmap_next(it, &rec) == 1);
+	CHECK(rec.type == PROCMAP_REC_STATS);
+	CHECK(procmap_get_ull(&rec, "nr_vmas", 0) == 2);
+	CHECK(procmap_get_ull(&rec, "kernel_vas_size", 0) == 140737488355328ULL);
+
+	/* the array's left as it's raw JSON */
+	CHECK(procmap_next(it, &rec) == 1);
+	CHECK(rec.type == PROCMAP_REC_FRAG);
+	CHECK(procmap_get_ull(&rec, "largest_hole_start", 0) == 0x1000);
+	CHECK(!strcmp(procmap_get(&rec, "hole_hist"),
+		      "[{\"lt\":\"64K\",\"count\":0,\"size\":0},{\"lt\":\"1G\",\"count\":1,\"size\":4096}]"));
+
+	/* a truncated record's an error, not a crash; then EOF */
+	errno = 0;
+	CHECK(procmap_next(it, &rec) == -1);
+	CHECK(errno == EBADMSG);
+	CHECK(procmap_next(it, &rec) == 0);
+
+	CHECK(procmap_close(it) == 0);
+	fclose(fp);
+
+	if (fails) {
+		fprintf(stderr, "test_jsonl: %d check(s) failed\n", fails);
+		return 1;
+	}
+	printf("test_jsonl: all checks passed\n");
+	return 0;
+}
@@ -12,6 +12,8 @@
 # License: MIT
 TMPF=/tmp/${name}/prep.$$
 TMPF_R=${TMPF}.reversed
+# (the PAGE_SIZE in our env might well be the hex one from the kernel details)
+PGSZ=$(getconf PAGE_SIZE)
 gencsv()
 {
 # CSV format for the foll fields:
@@ -32,6 +34,128 @@ cp ${TMPF_R} ${outfile}
 rm -f ${TMPF} ${TMPF_R} 2>/dev/null
 }
 
+# gencsv_lkm()
+# Generate the very same CSV as gencsv() does, but from the binary per-PID VMA
+# walk image that the procmap kernel module exports (via it's debugfs file
+# ${DBGFS_VMA_FILENAME}; see the comments in procmap_kernel/procmap.c for the
+# layout). We write the PID to it and read back the image on the same open fd.
+# As a bonus, we get the VMA flags that the maps file doesn't show; the
+# 'interesting' ones are written as annotations into ${ANNOTFILE}.
+# Returns 1 on any failure, so that the caller can fall back to gencsv().
+gencsv_lkm()
+{
+local vmafile=${DBGFS_LOC}/${KMOD}/${DBGFS_VMA_FILENAME}
+local raw=${TMPF}.raw strtab=${TMPF}.strtab
+local hdr magic ver nr recsz stroff le=1
+
+{ exec 3<>${vmafile} ; } 2>/dev/null || return 1
+echo ${PID} >&3 2>/dev/null || { exec 3>&- ; return 1 ; }
+cat <&3 > ${raw} 2>/dev/null || { exec 3>&- ; return 1 ; }
+exec 3>&-
+
+# header: magic version nr_vmas rec_size strtab_off strtab_len pid reserved
+hdr=$(od -An -v -tu4 -N32 ${raw} | xargs)
+read -r magic ver nr recsz stroff _ <<< "${hdr}"
+[[ "${magic}" != "1347245633" || "${ver}" != "1" || "${recsz}" != "48" ]] && {
+   decho "gencsv_lkm: unexpected VMA walk image header (${hdr}), skipping it"
+   rm -f ${raw}
+   return 1
+}
+# od -tx8 prints each u64 in host byte order; to split the last (dev, name_off)
+# word correctly, we need to know the endianness
+[[ $(printf '\001\000' | od -An -tu2 | xargs) != "1" ]] && le=0
+tail -c +$((stroff+1)) ${raw} | tr '\0' '\n' > ${strtab}
+
+# records: start end flags pgoff ino (name_off|dev)
+head -c ${stroff} ${raw} | od -An -v -tx8 -w48 -j32 | \
+ awk -v pgsz=${PGSZ} -v le=${le} -v annotfile=${ANNOTFILE} \
+	-v strtab=${strtab} "${AWK_HEXLIB}"'
+# Is bit b set in the (16 hex digit) flags word f?
+function flagbit(f, b,    d) {
+	d = index("0123456789abcdef", substr(f, 16-int(b/4), 1)) - 1
+	return int(d / (2 ^ (b%4))) % 2
+}
+# as the maps file does: at least 8 hex digits
+function trim0(h) {
+	while (length(h) > 8 && substr(h, 1, 1) == "0")
+		h = substr(h, 2)
+	return h
+}
+BEGIN {
+	off = 0
+	while ((getline ln < strtab) > 0) {
+		strname[off] = ln
+		off += length(ln) + 1
+	}
+	# the VM_* flags (and their smaps VmFlags mnemonic) worth pointing out
+	split("8 10 13 14 17 18 19 21 22 25 26 28 29 30 31", fbit, " ")
+	split("growsdown pfnmap locked io dontcopy dontexpand lockonfault noreserve hugetlb wipeonfork dontdump mixedmap hugepage nohugepage mergeable", fnm, " ")
+	nf = 15
+}
+NF == 6 {
+	start = trim0($1) ; end = trim0($2) ; flags = $3
+	if (le) {
+		noff = substr($6, 1, 8) ; dev = substr($6, 9, 8)
+	} else {
+		dev = substr($6, 1, 8) ; noff = substr($6, 9, 8)
+	}
+	nm = ""
+	if (noff != "ffffffff")
+		nm = strname[hex2dec(noff)]
+	sub(/ .*/, "", nm)	# as gencsv() does, just the first word of the name
+
+	mode = (flagbit(flags, 0) ? "r" : "-") (flagbit(flags, 1) ? "w" : "-") \
+	       (flagbit(flags, 2) ? "x" : "-") (flagbit(flags, 7) ? "s" : "p")
+	offset = "00000000"
+	if (hex2dec($5) != 0)	# file-backed
+		offset = sprintf("%08s", dec2hex(hex2dec($4) * pgsz))
+	gsub(/ /, "0", offset)
+	printf("%s,%s,%s,%s,%s\n", start, end, mode, offset, nm)
+
+	notable = ""
+	for (i = 1; i <= nf; i++)
+		if (flagbit(flags, fbit[i]))
+			notable = notable " " fnm[i]
+	if (notable != "") {
+		key = start ; sub(/^0+/, "", key)
+		printf("%s,vm_flags 0x%s:%s\n", key, trim0(flags), notable) >> annotfile
+	}
+}' > ${TMPF}
+rm -f ${raw} ${strtab}
+[ -s ${TMPF} ] || return 1
+
+tac ${TMPF} > ${outfile}
+rm -f ${TMPF}
+vecho "VMAs obtained via the ${KMOD} kernel module (${nr} VMAs)"
+return 0
+}
+
+# pgtable_stats_lkm()
+# Annotate each mapping with how it's actually backed, as seen by the procmap
+# kernel module's walk of the process page tables (it's debugfs file
+# ${DBGFS_PGTBL_FILENAME}): the # of present PTEs (base pages), of PMD- and
+# PUD-level huge mappings (THP/hugetlb) and of page-table pages. Thus, one can
+# see at a glance which mappings are fragmented into base pages and which use
+# huge pages.
+pgtable_stats_lkm()
+{
+local ptfile=${DBGFS_LOC}/${KMOD}/${DBGFS_PGTBL_FILENAME}
+local rpt=${TMPF}.pgtbl
+
+{ exec 3<>${ptfile} ; } 2>/dev/null || return 1
+echo ${PID} >&3 2>/dev/null || { exec 3>&- ; return 1 ; }
+cat <&3 > ${rpt} 2>/dev/null || { exec 3>&- ; return 1 ; }
+exec 3>&-
+
+# start end present_ptes pmd_leaves pud_leaves pgtable_pages
+awk -v pgsz=${PGSZ} '
+NF == 6 && ($3 + $4 + $5 + $6) > 0 {
+	printf("%s,pgtables: %d PTEs (%.0f KB), %d PMD + %d PUD huge; %d pt pages\n",
+		$1, $3, $3*pgsz/1024, $4, $5, $6)
+}' ${rpt} >> ${ANNOTFILE}
+rm -f ${rpt}
+}
+
 
 ##### 'main' : execution starts here #####
 
@@ -40,7 +164,7 @@ rm -f ${TMPF} ${TMPF_R} 2>/dev/null
   exit 1
 }
 
-infile=/proc/$1/maps
+infile=${PROC_ROOT}/$1/maps
 outfile=$2
 
 [ ! -r ${infile} ] && {
@@ -50,5 +174,20 @@ outfile=$2
 [ -f ${outfile} ] && {
   decho "${name}: !WARNING! \"${outfile}\" exists, will be overwritten!"
 }
-gencsv
+PID=$1
+rm -f ${ANNOTFILE}
+# Prefer the kernel module's VMA walk when it's available (i.e., when it's
+# loaded and we're root - and it's a live process, not a --render); else,
+# parse the maps file
+if [ "${PROC_ROOT}" = "/proc" -a -w ${DBGFS_LOC}/${KMOD}/${DBGFS_VMA_FILENAME} ] ; then
+   gencsv_lkm || {
+     rm -f ${ANNOTFILE}
+     gencsv
+   }
+else
+   gencsv
+fi
+[ ${SHOW_PGTABLE_STATS} -eq 1 -a "${PROC_ROOT}" = "/proc" -a -w ${DBGFS_LOC}/${KMOD}/${DBGFS_PGTBL_FILENAME} ] && {
+   pgtable_stats_lkm || true
+}
 exit 0
@@ -30,6 +30,22 @@
 #include <linux/vmalloc.h>
 #include <linux/debugfs.h>
 #include <linux/version.h>
+#include <linux/uaccess.h>
+#include <linux/pid.h>
+#include <linux/fs.h>
+#include <linux/kdev_t.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+#include <linux/kprobes.h>
+#include <linux/ptrace.h>
+#include <linux/log2.h>
+#include <linux/workqueue.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#include <linux/sched/clock.h>
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#endif
+#include <asm/syscall.h>
 #include <asm/pgtable.h>
 #include <asm/fixmap.h>
 #include "convenient.h"
@@ -50,11 +66,17 @@ MODULE_VERSION("0.2");
 #define TYPECST	    unsigned long
 #endif
 
-#define MAXLEN		2048
-#define ELLPS "|                           [ . . . ]                         |\n"
-
 static struct dentry *gparent;
-DEFINE_MUTEX(mtx);
+
+/* The VMA iterator (maple tree) replaced the vm_next linked list in 6.1 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0)
+#define PROCMAP_HAVE_VMA_ITER
+#endif
+/* The mmap_lock wrappers came in with 5.8; earlier, it's the mmap_sem rwsem */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 8, 0)
+#define mmap_read_lock_killable(mm)	down_read_killable(&(mm)->mmap_sem)
+#define mmap_read_unlock(mm)		up_read(&(mm)->mmap_sem)
+#endif
 
 #include <linux/string.h>
 /*
@@ -91,9 +113,48 @@ static inline int effective_rhel_release_code(void)
 }
 
 /*
- * query_kernelseg_details
- * Display kernel segment details as applicable to the architecture we're
- * currently running upon.
+ * The kernel segment layout.
+ * It's computed just once - at init - into the kseg_layout[] array (see
+ * kseg_layout_init() below); the debugfs file 'disp_kernelseg_details'
+ * streams it out, a record at a time, via the seq_file interface. As it's
+ * never modified afterward, the read path needs no locking at all (so any
+ * number of concurrent readers don't serialize), and there's no limit to
+ * the number of regions (or to the size of the report). The one exception
+ * is TASK_SIZE: it depends on the reader (a compat task's is smaller), so
+ * it's evaluated as it's shown.
+ */
+struct kseg_rec {
+	unsigned long start, end;
+	const char *mode;	/* NULL => a kernel variable: <name>,<value=start> */
+	const char *name;
+};
+
+static struct kseg_rec *kseg_layout;
+static unsigned int kseg_nr, kseg_max;
+
+/* Append a record to the layout */
+static int kseg_add(unsigned long start, unsigned long end, const char *mode,
+		    const char *name)
+{
+	if (kseg_nr == kseg_max) {
+		unsigned int newmax = kseg_max ? kseg_max * 2 : 16;
+		struct kseg_rec *newl = krealloc(kseg_layout, newmax * sizeof(*newl),
+						 GFP_KERNEL);
+
+		if (!newl)
+			return -ENOMEM;
+		kseg_layout = newl;
+		kseg_max = newmax;
+	}
+	kseg_layout[kseg_nr++] = (struct kseg_rec) {
+		.start = start, .end = end, .mode = mode, .name = name };
+	return 0;
+}
+
+/*
+ * kseg_layout_init
+ * Work out the kernel segment details as applicable to the architecture
+ * we're currently running upon.
  * Format (for most of the details):
  *   start_kva,end_kva,<mode>,<name-of-region>
  *
@@ -110,12 +171,13 @@ static inline int effective_rhel_release_code(void)
  *   start_kva,end_kva,<mode>,<name-of-region>
  * f.e. on an x86_64 VM w/ 2047 MB RAM
  *   0xffff92dac0000000,0xffff92db3fff0000,rwx,lowmem region
+ * Followed by a few key kernel variables, as:
+ *   <name>,<value>
  */
-static void query_kernelseg_details(char *buf)
+static int kseg_layout_init(void)
 {
-#define TMPMAX	256
-	char tmpbuf[TMPMAX];
-	unsigned long ram_size;
+	unsigned long ram_size = 0;
+	int ret = 0;
 
 	// RHEL: Rocky/Alma/...
 	if (using_rhel)
@@ -140,19 +202,11 @@ static void query_kernelseg_details(char *buf)
 #ifdef ARM
 	/* On ARM, the definition of VECTORS_BASE turns up only in kernels >= 4.11 */
 #if LINUX_VERSION_CODE > KERNEL_VERSION(4, 11, 0)
-	memset(tmpbuf, 0, TMPMAX);
-	snprintf(tmpbuf, TMPMAX,
-		 "%08x,%08lx,r--,vector table\n",
-		 //FMTSPC "," FMTSPC ",r--,vector table\n",
-		 (TYPECST) VECTORS_BASE, (TYPECST) VECTORS_BASE + PAGE_SIZE);
-	strlcat(buf, tmpbuf, MAXLEN);
+	ret |= kseg_add(VECTORS_BASE, VECTORS_BASE + PAGE_SIZE, "r--", "vector table");
 #endif
 #endif
 
 	/* kernel fixmap region */
-	memset(tmpbuf, 0, TMPMAX);
-	snprintf(tmpbuf, TMPMAX,
-		 FMTSPC "," FMTSPC ",r--,fixmap region\n",
 #ifdef CONFIG_ARM
 	/* On ARM, the FIXADDR_START macro's only defined from 5.11!
 	 * For earlier kernels, as a really silly and ugly workaround am simply
@@ -161,12 +215,10 @@ static void query_kernelseg_details(char *buf)
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 11, 0)
 #define FIXADDR_START 0xffc00000UL
 #endif
-		 (TYPECST) FIXADDR_START, (TYPECST) FIXADDR_END
+	ret |= kseg_add(FIXADDR_START, FIXADDR_END, "r--", "fixmap region");
 #else
-		 (TYPECST) FIXADDR_START, (TYPECST) FIXADDR_START + FIXADDR_SIZE
+	ret |= kseg_add(FIXADDR_START, FIXADDR_START + FIXADDR_SIZE, "r--", "fixmap region");
 #endif
-	);
-	strlcat(buf, tmpbuf, MAXLEN);
 
 	/* kernel module region
 	 * For the modules region, it's high in the kernel segment on typical 64-bit
@@ -175,46 +227,27 @@ static void query_kernelseg_details(char *buf)
 	 * arch, thus trying to maintain a 'by descending address' ordering.
 	 */
 #if (BITS_PER_LONG == 64)
-	memset(tmpbuf, 0, TMPMAX);
-	snprintf(tmpbuf, TMPMAX,
-		 FMTSPC "," FMTSPC ",rwx,module region\n",
-		 (TYPECST) MODULES_VADDR, (TYPECST) MODULES_END);
-	strlcat(buf, tmpbuf, MAXLEN);
+	ret |= kseg_add(MODULES_VADDR, MODULES_END, "rwx", "module region");
 #endif
 
 #ifdef CONFIG_KASAN		// KASAN region: Kernel Address SANitizer
-	memset(tmpbuf, 0, TMPMAX);
-	snprintf(tmpbuf, TMPMAX,
-		 FMTSPC "," FMTSPC ",rw-,KASAN shadow\n",
-		 (TYPECST) KASAN_SHADOW_START, (TYPECST) KASAN_SHADOW_END);
-	strlcat(buf, tmpbuf, MAXLEN);
+	ret |= kseg_add(KASAN_SHADOW_START, KASAN_SHADOW_END, "rw-", "KASAN shadow");
 #endif
 
 	/* TODO - sparsemem model; vmemmap region */
 
 	/* vmalloc region */
-	memset(tmpbuf, 0, TMPMAX);
-	snprintf(tmpbuf, TMPMAX,
-		 FMTSPC "," FMTSPC ",rw-,vmalloc region\n",
-		 (TYPECST) VMALLOC_START, (TYPECST) VMALLOC_END);
-	strlcat(buf, tmpbuf, MAXLEN);
+	ret |= kseg_add(VMALLOC_START, VMALLOC_END, "rw-", "vmalloc region");
 
 	/* lowmem region: spans from PAGE_OFFSET for size of platform RAM */
-	memset(tmpbuf, 0, TMPMAX);
-	snprintf(tmpbuf, TMPMAX,
-		 FMTSPC "," FMTSPC ",rwx,lowmem region\n",
-		 (TYPECST)PAGE_OFFSET, (TYPECST)(PAGE_OFFSET + ram_size));
-	strlcat(buf, tmpbuf, MAXLEN);
+	ret |= kseg_add(PAGE_OFFSET, PAGE_OFFSET + ram_size, "rwx", "lowmem region");
 
-	pr_debug("high_memory = 0x%016lx\n", high_memory);
+	pr_debug("high_memory = 0x%016lx\n", (unsigned long)high_memory);
 
 	/* (possible) highmem region;  may be present on some 32-bit systems */
 #if defined(CONFIG_HIGHMEM)  && (BITS_PER_LONG==32)
-	memset(tmpbuf, 0, TMPMAX);
-	snprintf(tmpbuf, TMPMAX,
-		 FMTSPC "," FMTSPC ",rwx,HIGHMEM region\n",
-		 (TYPECST) PKMAP_BASE, (TYPECST) (PKMAP_BASE) + (LAST_PKMAP * PAGE_SIZE));
-	strlcat(buf, tmpbuf, MAXLEN);
+	ret |= kseg_add(PKMAP_BASE, PKMAP_BASE + (LAST_PKMAP * PAGE_SIZE), "rwx",
+			"HIGHMEM region");
 #endif
 
 	/*
@@ -228,57 +261,1468 @@ static void query_kernelseg_details(char *buf)
 	 */
 
 #if (BITS_PER_LONG == 32)	/* modules region: see the comment above reg this */
-	memset(tmpbuf, 0, TMPMAX);
-	snprintf(tmpbuf, TMPMAX,
-		 FMTSPC "," FMTSPC ",rwx,module region:\n",
-		 (TYPECST)MODULES_VADDR, (TYPECST)MODULES_END);
-	strlcat(buf, tmpbuf, MAXLEN);
+	ret |= kseg_add(MODULES_VADDR, MODULES_END, "rwx", "module region:");
 #endif
 
 #include <asm/processor.h>
 	/* Enhancement: also pass along other key kernel vars */
-	memset(tmpbuf, 0, TMPMAX);
-	snprintf(tmpbuf, TMPMAX,
-		 "PAGE_SIZE," FMTSPC "\n"
-		 "TASK_SIZE," FMTSPC "\n",
-//		"high_memory," FMTSPC "\n",
-		 (TYPECST) PAGE_SIZE, (TYPECST) TASK_SIZE); //, high_memory);
-	strlcat(buf, tmpbuf, MAXLEN);
+	ret |= kseg_add(PAGE_SIZE, 0, NULL, "PAGE_SIZE");
+	/* TASK_SIZE depends on the task reading it (compat or not): it's
+	 * value is filled in, for the reader, by kseg_seq_show() */
+	ret |= kseg_add(0, 0, NULL, "TASK_SIZE");
+
+	return ret ? -ENOMEM : 0;
 }
 
-/* Our debugfs file 1's read callback function */
-static ssize_t dbgfs_show_kernelseg(struct file *filp, char __user *ubuf,
-				    size_t count, loff_t *fpos)
+/* Our debugfs file 1's seq_file iterator: one kseg_layout[] record per step */
+static void *kseg_seq_start(struct seq_file *m, loff_t *pos)
 {
-	char *kbuf;
-	ssize_t ret = 0;
+	return *pos < kseg_nr ? &kseg_layout[*pos] : NULL;
+}
+
+static void *kseg_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
+	return kseg_seq_start(m, pos);
+}
+
+static void kseg_seq_stop(struct seq_file *m, void *v)
+{
+}
+
+static int kseg_seq_show(struct seq_file *m, void *v)
+{
+	const struct kseg_rec *r = v;
+
+	if (r->mode)
+		seq_printf(m, FMTSPC "," FMTSPC ",%s,%s\n",
+			   (TYPECST)r->start, (TYPECST)r->end, r->mode, r->name);
+	else if (!strcmp(r->name, "TASK_SIZE"))
+		/* in the reader's context: a 32-bit (compat) reader gets it's own */
+		seq_printf(m, "%s," FMTSPC "\n", r->name, (TYPECST)TASK_SIZE);
+	else
+		seq_printf(m, "%s," FMTSPC "\n", r->name, (TYPECST)r->start);
+	return 0;
+}
+
+static const struct seq_operations kseg_seq_ops = {
+	.start = kseg_seq_start,
+	.next = kseg_seq_next,
+	.stop = kseg_seq_stop,
+	.show = kseg_seq_show,
+};
+
+static int dbgfs_kseg_open(struct inode *inode, struct file *filp)
+{
+	return seq_open(filp, &kseg_seq_ops);
+}
+
+static const struct file_operations dbgfs_fops = {
+	.owner = THIS_MODULE,
+	.open = dbgfs_kseg_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release,
+};
+
+/*
+ * The per-PID VMA walk.
+ * Write a PID into the debugfs file 'vma_walk' and then read back - on the
+ * same open file - a compact binary image of that process's VMAs, generated
+ * via a single pass over them (with the mmap lock held for read). This saves
+ * usermode the whole format-as-text-and-reparse round trip of
+ * /proc/PID/maps, and yields the vm_flags that maps doesn't show.
+ *
+ * CAREFUL: An ABI (a binary one):
+ * The usermode scripts (mapsfile_prep.sh) depend on this layout; if you Must
+ * change it, bump PROCMAP_VMA_VERSION and update the scripts.
+ * The image is laid out thus (all fields host-endian):
+ *   struct procmap_vma_hdr
+ *   struct procmap_vma_rec [nr_vmas]  ; in ascending va order
+ *   string table                      ; NUL-terminated names, at strtab_off
+ * A record's name_off is the offset of it's name within the string table;
+ * unnamed (anonymous) mappings have name_off = PROCMAP_VMA_NONAME.
+ * For file mappings, ino and dev identify the file (dev being encoded as
+ * by new_encode_dev()); for anonymous mappings both are 0.
+ */
+#define PROCMAP_VMA_MAGIC	0x504d5641	/* "PMVA" */
+#define PROCMAP_VMA_VERSION	1
+#define PROCMAP_VMA_NONAME	0xffffffff
+
+struct procmap_vma_hdr {
+	u32 magic;
+	u32 version;
+	u32 nr_vmas;
+	u32 rec_size;
+	u32 strtab_off;
+	u32 strtab_len;
+	u32 pid;
+	u32 reserved;
+} __packed;
+
+struct procmap_vma_rec {
+	u64 start;
+	u64 end;
+	u64 flags;		/* vma->vm_flags */
+	u64 pgoff;		/* vma->vm_pgoff (in pages) */
+	u64 ino;
+	u32 dev;
+	u32 name_off;
+} __packed;
+
+struct procmap_strtab {
+	char *buf;
+	size_t len, sz;
+};
+
+/*
+ * Per open file state for the per-PID report files ('vma_walk', 'pgtable_walk',
+ * 'accessed_walk'); no global lock required. @gen generates the report for the
+ * given PID into a kvmalloc'ed buffer.
+ */
+typedef int (*pid_report_fn)(pid_t nr, char **imgp, size_t *lenp);
+
+struct vma_walk_ctx {
+	struct mutex lock;
+	pid_report_fn gen;
+	char *img;
+	size_t len;
+};
+
+/*
+ * Append the string to the string table, returning it's offset via @off.
+ * Successive VMAs very often have the same name (f.e. the text, rodata and
+ * data of a shared library), so we reuse the previous entry when we can.
+ */
+static int strtab_add(struct procmap_strtab *st, const char *str, u32 *off,
+		      u32 *prev_off)
+{
+	size_t len = strlen(str) + 1;
+
+	if (*prev_off != PROCMAP_VMA_NONAME && !strcmp(st->buf + *prev_off, str)) {
+		*off = *prev_off;
+		return 0;
+	}
+	if (st->len + len > st->sz) {
+		size_t newsz = max(st->sz * 2, st->len + len + PAGE_SIZE);
+		char *newbuf = kvmalloc(newsz, GFP_KERNEL);
+
+		if (!newbuf)
+			return -ENOMEM;
+		if (st->buf) {
+			memcpy(newbuf, st->buf, st->len);
+			kvfree(st->buf);
+		}
+		st->buf = newbuf;
+		st->sz = newsz;
+	}
+	memcpy(st->buf + st->len, str, len);
+	*off = *prev_off = st->len;
+	st->len += len;
+	return 0;
+}
+
+/* Get a reference to the mm of the task with this PID; mmput() it when done */
+static struct mm_struct *procmap_get_mm(pid_t nr)
+{
+	struct pid *pid;
+	struct task_struct *task;
+	struct mm_struct *mm;
+
+	pid = find_get_pid(nr);
+	if (!pid)
+		return ERR_PTR(-ESRCH);
+	task = get_pid_task(pid, PIDTYPE_PID);
+	put_pid(pid);
+	if (!task)
+		return ERR_PTR(-ESRCH);
+	mm = get_task_mm(task);
+	put_task_struct(task);
+	if (!mm)		/* a kernel thread */
+		return ERR_PTR(-EINVAL);
+	return mm;
+}
+
+/* Name the VMA as /proc/PID/maps does; NULL if it's an unnamed one */
+static const char *vma_name(struct vm_area_struct *vma, char *pathbuf, int buflen)
+{
+	struct mm_struct *mm = vma->vm_mm;
+
+	if (vma->vm_file) {
+		char *path = file_path(vma->vm_file, pathbuf, buflen);
+
+		return IS_ERR(path) ? NULL : path;
+	}
+	if (vma->vm_ops && vma->vm_ops->name)	/* f.e. [vdso], [vvar] */
+		return vma->vm_ops->name(vma);
+	if (vma->vm_start <= mm->brk && vma->vm_end >= mm->start_brk)
+		return "[heap]";
+	if (vma->vm_start <= mm->start_stack && vma->vm_end >= mm->start_stack)
+		return "[stack]";
+	return NULL;
+}
+
+/*
+ * Fill in upto @max records - and the string table - in one pass over the
+ * VMAs of @mm; the caller holds the mmap lock (for read).
+ * Returns the number of records filled in, or a -ve errno.
+ */
+static int vma_walk_fill(struct mm_struct *mm, struct procmap_vma_rec *recs,
+			 unsigned int max, struct procmap_strtab *st, char *pathbuf)
+{
+	struct vm_area_struct *vma;
+	unsigned int n = 0;
+	u32 prev_off = PROCMAP_VMA_NONAME;
+	int ret;
+#ifdef PROCMAP_HAVE_VMA_ITER
+	VMA_ITERATOR(vmi, mm, 0);
+
+	for_each_vma(vmi, vma) {
+#else
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+#endif
+		struct procmap_vma_rec *rec;
+		u32 name_off = PROCMAP_VMA_NONAME;
+		const char *nm;
+
+		if (n >= max)
+			break;
+		rec = &recs[n];
+		rec->start = vma->vm_start;
+		rec->end = vma->vm_end;
+		rec->flags = vma->vm_flags;
+		rec->pgoff = vma->vm_pgoff;
+		rec->ino = 0;
+		rec->dev = 0;
+		if (vma->vm_file) {
+			struct inode *inode = file_inode(vma->vm_file);
+
+			rec->ino = inode->i_ino;
+			rec->dev = new_encode_dev(inode->i_sb->s_dev);
+		}
+		nm = vma_name(vma, pathbuf, PATH_MAX);
+		if (nm) {
+			/* (not &rec->name_off: the record's packed) */
+			ret = strtab_add(st, nm, &name_off, &prev_off);
+			if (ret)
+				return ret;
+		}
+		rec->name_off = name_off;
+		n++;
+	}
+	return n;
+}
+
+/*
+ * Walk the VMAs of the process @nr, generating the binary image described
+ * above into a (kvmalloc'ed) buffer; it's returned via @imgp and @lenp.
+ */
+static int vma_walk_pid(pid_t nr, char **imgp, size_t *lenp)
+{
+	struct mm_struct *mm;
+	struct procmap_vma_hdr *hdr;
+	struct procmap_vma_rec *recs = NULL;
+	struct procmap_strtab st = { };
+	char *pathbuf, *img;
+	size_t recs_len, len;
+	unsigned int max;
+	int n, ret = 0;
+
+	mm = procmap_get_mm(nr);
+	if (IS_ERR(mm))
+		return PTR_ERR(mm);
+	pathbuf = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!pathbuf) {
+		ret = -ENOMEM;
+		goto out_mmput;
+	}
+
+	if (mmap_read_lock_killable(mm)) {
+		ret = -EINTR;
+		goto out_free;
+	}
+	/* map_count is stable while we hold the mmap lock */
+	max = mm->map_count;
+	recs = kvmalloc_array(max ? max : 1, sizeof(*recs), GFP_KERNEL);
+	if (!recs) {
+		mmap_read_unlock(mm);
+		ret = -ENOMEM;
+		goto out_free;
+	}
+	n = vma_walk_fill(mm, recs, max, &st, pathbuf);
+	mmap_read_unlock(mm);
+	if (n < 0) {
+		ret = n;
+		goto out_free;
+	}
+
+	recs_len = n * sizeof(*recs);
+	len = sizeof(*hdr) + recs_len + st.len;
+	img = kvmalloc(len, GFP_KERNEL);
+	if (!img) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+	hdr = (struct procmap_vma_hdr *)img;
+	hdr->magic = PROCMAP_VMA_MAGIC;
+	hdr->version = PROCMAP_VMA_VERSION;
+	hdr->nr_vmas = n;
+	hdr->rec_size = sizeof(*recs);
+	hdr->strtab_off = sizeof(*hdr) + recs_len;
+	hdr->strtab_len = st.len;
+	hdr->pid = nr;
+	hdr->reserved = 0;
+	memcpy(img + sizeof(*hdr), recs, recs_len);
+	if (st.len)
+		memcpy(img + hdr->strtab_off, st.buf, st.len);
+	*imgp = img;
+	*lenp = len;
+	pr_debug("PID %d: %d VMAs, string table: %zu bytes\n", nr, n, st.len);
+
+ out_free:
+	kvfree(st.buf);
+	kvfree(recs);
+	kfree(pathbuf);
+ out_mmput:
+	mmput(mm);
+	return ret;
+}
+
+/*
+ * The per-PID page-table walk.
+ * Same protocol as the 'vma_walk' file: write a PID into the debugfs file
+ * 'pgtable_walk', then read back - on the same open file - one text line
+ * per VMA (in ascending va order):
+ *  start end present_ptes pmd_leaves pud_leaves pgtable_pages
+ * start and end are in hex, the rest in decimal, space separated; where:
+ *  present_ptes  : # of present PTEs (i.e., 'base' pages mapped)
+ *  pmd_leaves    : # of PMD-level huge mappings (THP or hugetlb; 2 MB on x86_64)
+ *  pud_leaves    : # of PUD-level huge mappings (1 GB on x86_64)
+ *  pgtable_pages : # of page table pages (PTE, PMD and PUD tables; not the top
+ *                  level) that map the VMA. One that straddles two VMAs is
+ *                  counted for each of them.
+ * We walk the page tables with the mmap lock held for read; the PTE tables
+ * are scanned under their lock, via pte_offset_map_lock() (which, from 6.5,
+ * re-checks the pmd: a table can be freed under us via khugepaged otherwise;
+ * see pt_walk_pte()).
+ * It's a statistical snapshot; it isn't precise wrt concurrent faults, and
+ * needn't be.
+ */
+struct pt_stats {
+	unsigned long present, pmd_leaves, pud_leaves, pt_pages;
+	/* the 'accessed_walk' (see below) only */
+	struct vm_area_struct *vma;
+	bool clear_young;
+	unsigned long young, young_pmds;
+};
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+#define procmap_pmd_leaf(pmd)	pmd_leaf(pmd)
+#define procmap_pud_leaf(pud)	pud_leaf(pud)
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#define procmap_pmd_leaf(pmd)	(pmd_trans_huge(pmd) || pmd_huge(pmd))
+#define procmap_pud_leaf(pud)	(pud_trans_huge(pud) || pud_huge(pud))
+#else
+#define procmap_pmd_leaf(pmd)	(pmd_trans_huge(pmd) || pmd_huge(pmd))
+#define procmap_pud_leaf(pud)	pud_huge(pud)
+#endif
+/* ptep_get() is recent; older kernels just dereference */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 8, 0)
+#define ptep_get(ptep)		(*(ptep))
+#endif
+/*
+ * Test and clear the accessed ('young') bit. On x86 we do it ourselves (the
+ * kernel's ptep_test_and_clear_young() isn't exported); elsewhere it's an
+ * inline, for PTEs. PMD-level huge mappings are only tracked on x86.
+ */
+#ifdef CONFIG_X86
+#define procmap_ptep_test_and_clear_young(vma, addr, ptep)	\
+	test_and_clear_bit(_PAGE_BIT_ACCESSED, (unsigned long *)&(ptep)->pte)
+#define procmap_pmdp_test_and_clear_young(pmdp)	\
+	test_and_clear_bit(_PAGE_BIT_ACCESSED, (unsigned long *)(pmdp))
+#else
+#define procmap_ptep_test_and_clear_young(vma, addr, ptep)	\
+	ptep_test_and_clear_young((vma), (addr), (ptep))
+#define procmap_pmdp_test_and_clear_young(pmdp)	0
+#endif
+
+/*
+ * Walk a PTE table, via pte_offset_map_lock(): it maps the table (if it's in
+ * highmem) and takes it's lock; on >= 6.5 - where khugepaged can retract the
+ * table (clear the pmd, free the table) with just the pmd lock, not the mmap
+ * lock we hold - it also re-checks the pmd under the lock, and fails if it's
+ * changed meanwhile (retracted, collapsed, ...): then we skip it.
+ */
+static void pt_walk_pte(pmd_t *pmd, unsigned long addr, unsigned long end,
+			struct pt_stats *st)
+{
+	pte_t *start_pte, *pte;
+	spinlock_t *ptl;
+
+	start_pte = pte_offset_map_lock(st->vma->vm_mm, pmd, addr, &ptl);
+	if (!start_pte)
+		return;
+	pte = start_pte;
+	do {
+		if (!pte_present(ptep_get(pte)))
+			continue;
+		st->present++;
+		if (st->clear_young && procmap_ptep_test_and_clear_young(st->vma, addr, pte))
+			st->young++;
+	} while (pte++, addr += PAGE_SIZE, addr != end);
+	pte_unmap_unlock(start_pte, ptl);
+}
+
+static void pt_walk_pmd(pud_t *pud, unsigned long addr, unsigned long end,
+			struct pt_stats *st)
+{
+	pmd_t *pmd = pmd_offset(pud, addr);
+	unsigned long next;
+
+	do {
+		pmd_t pmdval = READ_ONCE(*pmd);
+
+		next = pmd_addr_end(addr, end);
+		if (pmd_none(pmdval) || !pmd_present(pmdval))
+			continue;
+		if (procmap_pmd_leaf(pmdval)) {
+			st->pmd_leaves++;
+			if (st->clear_young && procmap_pmdp_test_and_clear_young(pmd))
+				st->young_pmds++;
+			continue;
+		}
+		if (pmd_bad(pmdval))
+			continue;
+		st->pt_pages++;		/* the PTE table */
+		pt_walk_pte(pmd, addr, next, st);
+	} while (pmd++, addr = next, addr != end);
+}
+
+static void pt_walk_pud(pud_t *pud, unsigned long addr, unsigned long end,
+			struct pt_stats *st)
+{
+	unsigned long next;
+
+	do {
+		pud_t pudval = READ_ONCE(*pud);
+
+		next = pud_addr_end(addr, end);
+		if (pud_none(pudval) || !pud_present(pudval))
+			continue;
+		if (procmap_pud_leaf(pudval)) {
+			st->pud_leaves++;
+			continue;
+		}
+		if (pud_bad(pudval))
+			continue;
+		if (PTRS_PER_PMD > 1)	/* the PMD table; unless it's folded */
+			st->pt_pages++;
+		pt_walk_pmd(pud, addr, next, st);
+	} while (pud++, addr = next, addr != end);
+}
+
+/* The p4d level came in with 4.11 (5-level paging) */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+static void pt_walk_p4d(pgd_t *pgd, unsigned long addr, unsigned long end,
+			struct pt_stats *st)
+{
+	p4d_t *p4d = p4d_offset(pgd, addr);
+	unsigned long next;
+
+	do {
+		next = p4d_addr_end(addr, end);
+		if (p4d_none(*p4d) || p4d_bad(*p4d))
+			continue;
+		if (PTRS_PER_PUD > 1)	/* the PUD table; unless it's folded */
+			st->pt_pages++;
+		pt_walk_pud(pud_offset(p4d, addr), addr, next, st);
+	} while (p4d++, addr = next, addr != end);
+}
+#endif
+
+static void pt_walk_vma(struct vm_area_struct *vma, struct pt_stats *st)
+{
+	unsigned long addr = vma->vm_start, end = vma->vm_end, next;
+	pgd_t *pgd = pgd_offset(vma->vm_mm, addr);
+
+	do {
+		next = pgd_addr_end(addr, end);
+		if (pgd_none(*pgd) || pgd_bad(*pgd))
+			continue;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+		pt_walk_p4d(pgd, addr, next, st);
+#else
+		if (PTRS_PER_PUD > 1)
+			st->pt_pages++;
+		pt_walk_pud(pud_offset(pgd, addr), addr, next, st);
+#endif
+	} while (pgd++, addr = next, addr != end);
+}
+
+/* Max length of one line of the page-table walk report */
+#define PT_WALK_LINELEN		128
+
+/*
+ * Walk the page tables of each VMA of @mm, writing the report lines into
+ * @buf (of @sz bytes); the caller holds the mmap lock (for read). With
+ * @young, it's the 'accessed_walk' report (see below).
+ * Returns the length of the report.
+ */
+static size_t pt_walk_fill(struct mm_struct *mm, char *buf, size_t sz, bool young)
+{
+	struct vm_area_struct *vma;
+	size_t len = 0;
+#ifdef PROCMAP_HAVE_VMA_ITER
+	VMA_ITERATOR(vmi, mm, 0);
+
+	for_each_vma(vmi, vma) {
+#else
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+#endif
+		struct pt_stats st = { .vma = vma, .clear_young = young };
+
+		if (sz - len < PT_WALK_LINELEN)
+			break;
+		/* Don't touch IO/PFN mappings; there may be no struct pages behind */
+		if (!(vma->vm_flags & (VM_IO | VM_PFNMAP)))
+			pt_walk_vma(vma, &st);
+		if (young)
+			len += scnprintf(buf + len, sz - len, "%lx %lx %lu %lu %lu %lu\n",
+					 vma->vm_start, vma->vm_end, st.present,
+					 st.young, st.pmd_leaves, st.young_pmds);
+		else
+			len += scnprintf(buf + len, sz - len, "%lx %lx %lu %lu %lu %lu\n",
+					 vma->vm_start, vma->vm_end, st.present,
+					 st.pmd_leaves, st.pud_leaves, st.pt_pages);
+		cond_resched();
+	}
+	return len;
+}
+
+static int do_pt_walk_pid(pid_t nr, char **imgp, size_t *lenp, bool young)
+{
+	struct mm_struct *mm;
+	char *buf;
+	size_t sz;
+	int ret = 0;
+
+	mm = procmap_get_mm(nr);
+	if (IS_ERR(mm))
+		return PTR_ERR(mm);
+	if (mmap_read_lock_killable(mm)) {
+		ret = -EINTR;
+		goto out_mmput;
+	}
+	sz = (mm->map_count + 1) * PT_WALK_LINELEN;
+	buf = kvmalloc(sz, GFP_KERNEL);
+	if (!buf) {
+		mmap_read_unlock(mm);
+		ret = -ENOMEM;
+		goto out_mmput;
+	}
+	*lenp = pt_walk_fill(mm, buf, sz, young);
+	mmap_read_unlock(mm);
+	*imgp = buf;
+
+ out_mmput:
+	mmput(mm);
+	return ret;
+}
+
+static int pt_walk_pid(pid_t nr, char **imgp, size_t *lenp)
+{
+	return do_pt_walk_pid(nr, imgp, lenp, false);
+}
+
+/*
+ * The per-PID accessed-bit walk; for working set estimation (procmap's --wss)
+ * where idle page tracking (/sys/kernel/mm/page_idle) isn't available.
+ * Same protocol as the 'pgtable_walk' file; one line per VMA:
+ *  start end present_ptes young_ptes pmd_leaves young_pmd_leaves
+ * where young_* are the # of those that were accessed (the accessed bit was
+ * set) since the previous walk - as a side-effect, each walk clears the bits.
+ * So: write the PID (and ignore the report), wait for the interval, write it
+ * again and read the report.
+ * We don't flush the TLB after clearing the bits (nor does idle page tracking);
+ * a page that stays in the TLB throughout isn't seen as accessed: so it's an
+ * estimate, on the low side.
+ */
+static int young_walk_pid(pid_t nr, char **imgp, size_t *lenp)
+{
+	return do_pt_walk_pid(nr, imgp, lenp, true);
+}
+
+/*
+ * Kernel region occupancy.
+ * The debugfs file 'kseg_occupancy' reports, for the vmalloc, module and
+ * fixmap regions, how much of the region's actually in use - computed here,
+ * in-kernel, via a walk of the kernel page tables over the region. Empty
+ * upper level entries let us skip vast unused ranges at once, so it's cheap
+ * even with a very large number of vmap areas (unlike reading and parsing
+ * /proc/vmallocinfo). It's a statistical snapshot (as the kernel's own ptdump
+ * is): the page tables can change under us.
+ * One line per region, in CSV format:
+ *  start_kva,end_kva,used,nr_areas,largest_free_gap,h0:h1:...:h15,<name-of-region>
+ * where
+ *  used             : bytes mapped (present PTEs and huge PMD/PUD leaves)
+ *  nr_areas         : # of runs of contiguously mapped pages; as (almost) every
+ *                     vmalloc area is followed by an unmapped guard page, it's
+ *                     (very nearly) the # of areas
+ *  largest_free_gap : the largest run of unmapped va, in bytes
+ *  h0 ... h15       : the occupancy (%, 0-100) of each sixteenth of the region
+ *                     (lowest va first)
+ * The used, nr_areas and largest_free_gap fields are in decimal.
+ *
+ * CAREFUL: An ABI:
+ * The usermode scripts (do_kernelseg.sh) depend on this format; the
+ * <name-of-region> field's the same as in the 'disp_kernelseg_details' report.
+ *
+ * We need the kernel's top-level page table: that's init_mm's, when it's
+ * exported (see the Makefile); else, on x86, the kernel half of every
+ * process's top-level page table is the same as init_mm's, so we use ours.
+ */
+#if defined(PROCMAP_HAVE_INIT_MM)
+#define procmap_kpgd_offset(addr)	pgd_offset_k(addr)
+#elif defined(CONFIG_X86)
+#define procmap_kpgd_offset(addr)	pgd_offset(current->active_mm, (addr))
+#endif
+
+#ifdef procmap_kpgd_offset
+#define KOCC_NBUCKETS	16
+
+struct kocc {
+	unsigned long start, end;	/* the region: [start, end) */
+	unsigned long used, nr_areas, max_gap;
+	unsigned long run_end;		/* end of the last mapped run; 0 => none yet */
+	unsigned long hist[KOCC_NBUCKETS];	/* bytes mapped, per bucket */
+};
+
+/* Account for the mapped range [addr, addr+size) */
+static void kocc_add(struct kocc *oc, unsigned long addr, unsigned long size)
+{
+	unsigned long bsz = DIV_ROUND_UP(oc->end - oc->start, KOCC_NBUCKETS);
+
+	if (!oc->run_end || addr != oc->run_end) {	/* a new run */
+		oc->nr_areas++;
+		oc->max_gap = max(oc->max_gap,
+				  addr - (oc->run_end ? oc->run_end : oc->start));
+	}
+	oc->run_end = addr + size;
+	oc->used += size;
+	while (size) {
+		unsigned long b = (addr - oc->start) / bsz;
+		unsigned long n = min(size, oc->start + (b + 1) * bsz - addr);
+
+		oc->hist[b] += n;
+		addr += n;
+		size -= n;
+	}
+}
+
+/* Kernel PTE tables are never in highmem; pte_offset_kernel() is fine here */
+static void kocc_walk_pte(pmd_t *pmd, unsigned long addr, unsigned long end,
+			  struct kocc *oc)
+{
+	pte_t *pte = pte_offset_kernel(pmd, addr);
+
+	do {
+		if (pte_present(ptep_get(pte)))
+			kocc_add(oc, addr, PAGE_SIZE);
+	} while (pte++, addr += PAGE_SIZE, addr != end);
+}
+
+static void kocc_walk_pmd(pud_t *pud, unsigned long addr, unsigned long end,
+			  struct kocc *oc)
+{
+	pmd_t *pmd = pmd_offset(pud, addr);
+	unsigned long next;
+
+	do {
+		pmd_t pmdval = READ_ONCE(*pmd);
+
+		next = pmd_addr_end(addr, end);
+		if (pmd_none(pmdval) || !pmd_present(pmdval))
+			continue;
+		if (procmap_pmd_leaf(pmdval)) {		/* f.e. a huge vmap */
+			kocc_add(oc, addr, next - addr);
+			continue;
+		}
+		if (pmd_bad(pmdval))
+			continue;
+		kocc_walk_pte(pmd, addr, next, oc);
+	} while (pmd++, addr = next, addr != end);
+}
+
+static void kocc_walk_pud(pud_t *pud, unsigned long addr, unsigned long end,
+			  struct kocc *oc)
+{
+	unsigned long next;
+
+	do {
+		pud_t pudval = READ_ONCE(*pud);
+
+		next = pud_addr_end(addr, end);
+		if (pud_none(pudval) || !pud_present(pudval))
+			continue;
+		if (procmap_pud_leaf(pudval)) {
+			kocc_add(oc, addr, next - addr);
+			continue;
+		}
+		if (pud_bad(pudval))
+			continue;
+		kocc_walk_pmd(pud, addr, next, oc);
+		cond_resched();
+	} while (pud++, addr = next, addr != end);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+static void kocc_walk_p4d(pgd_t *pgd, unsigned long addr, unsigned long end,
+			  struct kocc *oc)
+{
+	p4d_t *p4d = p4d_offset(pgd, addr);
+	unsigned long next;
+
+	do {
+		next = p4d_addr_end(addr, end);
+		if (p4d_none(*p4d) || p4d_bad(*p4d))
+			continue;
+		kocc_walk_pud(pud_offset(p4d, addr), addr, next, oc);
+	} while (p4d++, addr = next, addr != end);
+}
+#endif
+
+/* Show the occupancy of the kernel region [start, end) */
+static void kocc_show_region(struct seq_file *m, const char *name,
+			     unsigned long start, unsigned long end)
+{
+	struct kocc oc = { .start = start & PAGE_MASK, .end = PAGE_ALIGN(end) };
+	unsigned long addr = oc.start, next, bsz;
+	pgd_t *pgd;
+	int i;
 
-	if (mutex_lock_interruptible(&mtx))
+	if (oc.end <= oc.start)
+		return;
+	pgd = procmap_kpgd_offset(addr);
+	do {
+		next = pgd_addr_end(addr, oc.end);
+		if (pgd_none(*pgd) || pgd_bad(*pgd))
+			continue;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+		kocc_walk_p4d(pgd, addr, next, &oc);
+#else
+		kocc_walk_pud(pud_offset(pgd, addr), addr, next, &oc);
+#endif
+	} while (pgd++, addr = next, addr != oc.end);
+	/* the free gap at the top of the region */
+	oc.max_gap = max(oc.max_gap, oc.end - (oc.run_end ? oc.run_end : oc.start));
+
+	seq_printf(m, FMTSPC "," FMTSPC ",%lu,%lu,%lu,", (TYPECST)start, (TYPECST)end,
+		   oc.used, oc.nr_areas, oc.max_gap);
+	bsz = DIV_ROUND_UP(oc.end - oc.start, KOCC_NBUCKETS);
+	for (i = 0; i < KOCC_NBUCKETS; i++)
+		seq_printf(m, "%llu%c", div64_u64((u64)oc.hist[i] * 100, bsz),
+			   i < KOCC_NBUCKETS - 1 ? ':' : ',');
+	seq_printf(m, "%s\n", name);
+}
+
+static int kocc_show(struct seq_file *m, void *v)
+{
+	kocc_show_region(m, "vmalloc region", VMALLOC_START, VMALLOC_END);
+	kocc_show_region(m, "module region", MODULES_VADDR, MODULES_END);
+#ifdef CONFIG_ARM
+	kocc_show_region(m, "fixmap region", FIXADDR_START, FIXADDR_END);
+#else
+	kocc_show_region(m, "fixmap region", FIXADDR_START, FIXADDR_START + FIXADDR_SIZE);
+#endif
+	return 0;
+}
+
+static int dbgfs_kocc_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, kocc_show, NULL);
+}
+
+static const struct file_operations dbgfs_kocc_fops = {
+	.owner = THIS_MODULE,
+	.open = dbgfs_kocc_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+#endif				/* procmap_kpgd_offset */
+
+/*
+ * mm event tracing.
+ * The debugfs file 'mm_trace' traces the mmap, munmap, mremap, mprotect and
+ * brk system calls of one process (all it's threads) as they happen; so even
+ * short-lived mappings, that polling the maps would miss, are seen. Writing a
+ * PID starts tracing that process (resetting the buffers), writing 0 stops it.
+ * A kretprobe on each of the system calls (and, where there's a compat
+ * syscall table, on it's compat entry points too) does the work: it's entry
+ * handler filters on the tgid and saves the arguments; the return handler
+ * logs an event if the call succeeded. A kprobe can't be scoped to a process:
+ * while tracing, the probes fire for every process on the system. The others
+ * pay just the entry handler's compare (their kretprobe instance is released
+ * at once, and the return isn't probed), but that also means they compete for
+ * the instances: the ones missed - by any process - are reported ('# missed').
+ * The probes are registered only while tracing; else there's no overhead at
+ * all. Nor are they left armed when the user space end goes away without
+ * writing 0: the trace stops by itself once the traced process, or the one
+ * that started the trace, has exited (checked every second). The process is
+ * held by it's struct pid, not the PID number: a reused PID isn't traced.
+ *
+ * The events go into per-CPU rings: a ring has a single producer (the
+ * handlers, which run with preemption disabled, on that CPU) and a single
+ * consumer (the reader), so there are no locks, just the head and tail
+ * indices, published with release / acquire ordering. When a ring's full,
+ * events are dropped (and counted), never waited upon.
+ * There are two ways to consume them:
+ *  - read(): drains all the rings, in batches, as text; one event per line:
+ *     ts_ns cpu tid event addr len addr2 len2 caller
+ *    where event is one of mmap, munmap, mremap, mprotect or brk, and
+ *     mmap     : addr, len = the new mapping; addr2 = prot, len2 = flags
+ *     munmap   : addr, len
+ *     mremap   : addr, len = the old mapping; addr2, len2 = the new one
+ *     mprotect : addr, len; addr2 = prot
+ *     brk      : addr = the old brk, addr2 = the new one
+ *    The addresses (and caller) are in hex, the rest in decimal; caller is
+ *    the user-space return address into the call site (the code that called
+ *    the libc wrapper), see procmap_user_caller(). A line '# dropped N'
+ *    reports the events lost since the previous read (the rings were full),
+ *    '# missed N' the calls the kretprobes missed (system wide; they ran out
+ *    of instances), since the previous read. The lines are in time
+ *    order per CPU only: sort on ts_ns to merge them. Returns 0 (EOF) once
+ *    the rings are empty; it never blocks.
+ *  - mmap(): maps the rings themselves, for a consumer that does it's own
+ *    draining: nr_cpu_ids rings of mmtrace_ring_sz bytes each; a ring's a
+ *    struct procmap_ring_hdr (in it's own page) followed by nrec (a power of
+ *    2) struct procmap_mm_event records. Records [tail, head), modulo nrec,
+ *    are valid; consume them, then store the new tail (with release
+ *    semantics). Don't mix the two on the same trace.
+ *
+ * CAREFUL: An ABI:
+ * The usermode scripts (lib_procmap.sh:mm_trace()) depend on the text format;
+ * mmap consumers on the binary one: if you Must change it, bump
+ * PROCMAP_MMEV_VERSION.
+ */
+#if defined(CONFIG_KRETPROBES) && LINUX_VERSION_CODE >= KERNEL_VERSION(5, 3, 0)
+#define PROCMAP_HAVE_MMTRACE
+
+#define PROCMAP_MMEV_MAGIC	0x504d4556	/* "PMEV" */
+#define PROCMAP_MMEV_VERSION	1
+
+enum procmap_mmev_type {
+	MMEV_MMAP = 1,
+	MMEV_MUNMAP,
+	MMEV_MREMAP,
+	MMEV_MPROTECT,
+	MMEV_BRK,
+};
+
+static const char * const mmev_names[] = {
+	[MMEV_MMAP] = "mmap",
+	[MMEV_MUNMAP] = "munmap",
+	[MMEV_MREMAP] = "mremap",
+	[MMEV_MPROTECT] = "mprotect",
+	[MMEV_BRK] = "brk",
+};
+
+struct procmap_ring_hdr {
+	u32 magic;
+	u32 version;
+	u32 nrec;
+	u32 rec_size;
+	u32 head;		/* written by the producer (the kernel) */
+	u32 tail;		/* written by the consumer */
+	u32 dropped;		/* events lost as the ring was full */
+	u32 cpu;
+};
+
+struct procmap_mm_event {
+	u64 ts;			/* local_clock(), in ns */
+	u64 addr;
+	u64 len;
+	u64 addr2;
+	u64 len2;
+	u64 caller;
+	u32 tid;
+	u16 type;		/* enum procmap_mmev_type */
+	u16 cpu;
+};
+
+/* The per-CPU ring size (in KB), including it's header page */
+static uint mmtrace_ring_kb = 256;
+module_param(mmtrace_ring_kb, uint, 0444);
+MODULE_PARM_DESC(mmtrace_ring_kb, "per-CPU mm_trace ring size in KB (default 256)");
+
+static DEFINE_MUTEX(mmtrace_lock);	/* start / stop / read */
+static void *mmtrace_rings;		/* vmalloc_user'ed: nr_cpu_ids rings */
+static size_t mmtrace_ring_sz;
+static u32 mmtrace_nrec;
+static u32 *mmtrace_seen_drops;		/* per CPU: dropped, as of the last read */
+static struct pid *mmtrace_pid;		/* the traced process; NULL: not tracing */
+static struct pid *mmtrace_tracer;	/* the process that started the trace */
+static unsigned long mmtrace_seen_missed;	/* kretprobe misses, as of the last read */
+
+static inline struct procmap_ring_hdr *mmring_hdr(int cpu)
+{
+	return mmtrace_rings + cpu * mmtrace_ring_sz;
+}
+
+static inline struct procmap_mm_event *mmring_rec(int cpu, u32 idx)
+{
+	return (struct procmap_mm_event *)(mmtrace_rings + cpu * mmtrace_ring_sz + PAGE_SIZE) +
+		(idx & (mmtrace_nrec - 1));
+}
+
+/* Log the event to this CPU's ring; preemption's disabled (we're in a kprobe handler) */
+static void mmev_log(struct procmap_mm_event *ev)
+{
+	int cpu = smp_processor_id();
+	struct procmap_ring_hdr *h = mmring_hdr(cpu);
+	u32 head = READ_ONCE(h->head);
+
+	/* (the header's mapped to user space; we only ever trust nrec as ours) */
+	if (head - smp_load_acquire(&h->tail) >= mmtrace_nrec) {
+		WRITE_ONCE(h->dropped, h->dropped + 1);
+		return;
+	}
+	ev->cpu = cpu;
+	*mmring_rec(cpu, head) = *ev;
+	smp_store_release(&h->head, head + 1);
+}
+
+/*
+ * The call site: the return address into the code that called the libc
+ * wrapper. On arm and arm64 it's in the link register; elsewhere, the libc
+ * wrappers for these calls are leaf functions that don't touch the stack, so
+ * it's the word at the top of the user stack (if we can't read it, the
+ * syscall instruction's address will have to do).
+ */
+static unsigned long procmap_user_caller(struct pt_regs *uregs)
+{
+#if defined(CONFIG_ARM64)
+	return uregs->regs[30];
+#elif defined(CONFIG_ARM)
+	return uregs->ARM_lr;
+#else
+	unsigned long ra;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+	if (!copy_from_user_nofault(&ra, (void __user *)user_stack_pointer(uregs), sizeof(ra)))
+#else
+	if (!probe_user_read(&ra, (void __user *)user_stack_pointer(uregs), sizeof(ra)))
+#endif
+		return ra;
+	return instruction_pointer(uregs);
+#endif
+}
+
+struct procmap_mmprobe {
+	struct kretprobe rp;
+	const char *call;	/* the system call */
+	int type;
+	bool argstruct;		/* the args are in a user struct; see mmprobe_argstruct() */
+	bool registered;
+};
+
+/* What the entry handler passes on to the return handler */
+struct mmprobe_data {
+	unsigned long args[6];
+	unsigned long caller;
+	unsigned long brk;	/* brk(): the brk, as of the entry */
+	int type;
+};
+
+/*
+ * The (ia32) old_mmap() takes a pointer to it's arguments: a struct of six
+ * u32s (addr, len, prot, flags, fd, offset)
+ */
+static void mmprobe_argstruct(struct mmprobe_data *d)
+{
+	u32 a[4];
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+	if (copy_from_user_nofault(a, (void __user *)d->args[0], sizeof(a)))
+#else
+	if (probe_user_read(a, (void __user *)d->args[0], sizeof(a)))
+#endif
+		memset(a, 0, sizeof(a));
+	d->args[0] = a[0];
+	d->args[1] = a[1];
+	d->args[2] = a[2];
+	d->args[3] = a[3];
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+#define procmap_ri_rp(ri)	get_kretprobe(ri)
+#else
+#define procmap_ri_rp(ri)	((ri)->rp)
+#endif
+
+static int mmprobe_entry(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+	struct mmprobe_data *d = (struct mmprobe_data *)ri->data;
+	struct procmap_mmprobe *probe;
+	struct kretprobe *rp;
+	struct pt_regs *uregs;
+
+	if (task_tgid(current) != READ_ONCE(mmtrace_pid))
+		return 1;	/* not the process we trace: skip the return handler */
+	rp = procmap_ri_rp(ri);
+	if (!rp)
+		return 1;
+	probe = container_of(rp, struct procmap_mmprobe, rp);
+	uregs = current_pt_regs();
+	/* (this gets the compat ones right too, for a compat syscall) */
+	syscall_get_arguments(current, uregs, d->args);
+	if (probe->argstruct)
+		mmprobe_argstruct(d);
+	d->caller = procmap_user_caller(uregs);
+	d->type = probe->type;
+	/*
+	 * brk() returns the new brk; the old one's the process's, per call (the
+	 * threads' calls are serialized by the mmap lock in brk() itself, but
+	 * can interleave with us; this is as of just before this one)
+	 */
+	if (d->type == MMEV_BRK)
+		d->brk = READ_ONCE(current->mm->brk);
+	return 0;
+}
+
+static int mmprobe_ret(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+	struct mmprobe_data *d = (struct mmprobe_data *)ri->data;
+	unsigned long ret = regs_return_value(regs);
+	struct procmap_mm_event ev = {
+		.ts = local_clock(),
+		.tid = current->pid,
+		.type = d->type,
+		.caller = d->caller,
+	};
+
+	if (IS_ERR_VALUE(ret))
+		return 0;
+	switch (d->type) {
+	case MMEV_MMAP:
+		ev.addr = ret;
+		ev.len = d->args[1];
+		ev.addr2 = d->args[2];
+		ev.len2 = d->args[3];
+		break;
+	case MMEV_MUNMAP:
+	case MMEV_MPROTECT:
+		ev.addr = d->args[0];
+		ev.len = d->args[1];
+		ev.addr2 = (d->type == MMEV_MPROTECT) ? d->args[2] : 0;
+		break;
+	case MMEV_MREMAP:
+		ev.addr = d->args[0];
+		ev.len = d->args[1];
+		ev.addr2 = ret;
+		ev.len2 = d->args[2];
+		break;
+	case MMEV_BRK:
+		/* brk() returns the (new, or unchanged) brk; failing, the old one */
+		if (ret == d->brk)
+			return 0;
+		ev.addr = d->brk;
+		ev.addr2 = ret;
+		break;
+	default:
+		return 0;
+	}
+	mmev_log(&ev);
+	return 0;
+}
+
+/*
+ * The system calls' symbols: the per-arch syscall wrappers (they take the
+ * user pt_regs) where the arch has them; we get the arguments from the user
+ * regs anyway, so either works.
+ * A 32-bit process on a 64-bit kernel enters via the compat syscall table:
+ * on x86_64 that's a separate set of (__ia32_) wrappers, mmap being mmap2
+ * (mmap_pgoff) or the old_mmap (ia32_mmap); on arm64 the compat table shares
+ * the native wrappers, except for mmap2.
+ */
+#if defined(CONFIG_X86_64) && defined(CONFIG_ARCH_HAS_SYSCALL_WRAPPER)
+#define PROCMAP_SYS(call)	"__x64_sys_" call
+#ifdef CONFIG_IA32_EMULATION
+#define PROCMAP_COMPAT_SYS(call)	"__ia32_sys_" call
+#endif
+#elif defined(CONFIG_ARM64) && defined(CONFIG_ARCH_HAS_SYSCALL_WRAPPER)
+#define PROCMAP_SYS(call)	"__arm64_sys_" call
+#elif defined(CONFIG_RISCV) && defined(CONFIG_ARCH_HAS_SYSCALL_WRAPPER)
+#define PROCMAP_SYS(call)	"__riscv_sys_" call
+#else
+#define PROCMAP_SYS(call)	"sys_" call
+#endif
+
+static struct procmap_mmprobe mmprobes[] = {
+#ifdef CONFIG_ARM
+	{ .call = PROCMAP_SYS("mmap_pgoff"), .type = MMEV_MMAP },	/* (mmap2) */
+#else
+	{ .call = PROCMAP_SYS("mmap"), .type = MMEV_MMAP },
+#endif
+	{ .call = PROCMAP_SYS("munmap"), .type = MMEV_MUNMAP },
+	{ .call = PROCMAP_SYS("mremap"), .type = MMEV_MREMAP },
+	{ .call = PROCMAP_SYS("mprotect"), .type = MMEV_MPROTECT },
+	{ .call = PROCMAP_SYS("brk"), .type = MMEV_BRK },
+#ifdef PROCMAP_COMPAT_SYS
+	{ .call = PROCMAP_COMPAT_SYS("mmap_pgoff"), .type = MMEV_MMAP },	/* (mmap2) */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+	{ .call = "__ia32_compat_sys_ia32_mmap", .type = MMEV_MMAP, .argstruct = true },
+#else
+	{ .call = "__ia32_compat_sys_x86_mmap", .type = MMEV_MMAP, .argstruct = true },
+#endif
+	{ .call = PROCMAP_COMPAT_SYS("munmap"), .type = MMEV_MUNMAP },
+	{ .call = PROCMAP_COMPAT_SYS("mremap"), .type = MMEV_MREMAP },
+	{ .call = PROCMAP_COMPAT_SYS("mprotect"), .type = MMEV_MPROTECT },
+	{ .call = PROCMAP_COMPAT_SYS("brk"), .type = MMEV_BRK },
+#elif defined(CONFIG_ARM64) && defined(CONFIG_COMPAT) && defined(CONFIG_ARCH_HAS_SYSCALL_WRAPPER)
+	{ .call = "__arm64_compat_sys_aarch32_mmap2", .type = MMEV_MMAP },
+#endif
+};
+
+static void mmtrace_stop(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(mmprobes); i++) {
+		if (!mmprobes[i].registered)
+			continue;
+		/* (this waits for any handler that's running to complete) */
+		unregister_kretprobe(&mmprobes[i].rp);
+		mmprobes[i].registered = false;
+	}
+	put_pid(mmtrace_pid);
+	put_pid(mmtrace_tracer);
+	WRITE_ONCE(mmtrace_pid, NULL);
+	mmtrace_tracer = NULL;
+}
+
+static bool mmtrace_alive(struct pid *pid)
+{
+	bool alive;
+
+	rcu_read_lock();
+	alive = pid_task(pid, PIDTYPE_TGID) != NULL;
+	rcu_read_unlock();
+	return alive;
+}
+
+/*
+ * Stop the trace once the traced process, or the tracer, has exited; runs
+ * every second while tracing
+ */
+static void mmtrace_reap(struct work_struct *work);
+static DECLARE_DELAYED_WORK(mmtrace_reaper, mmtrace_reap);
+
+static void mmtrace_reap(struct work_struct *work)
+{
+	mutex_lock(&mmtrace_lock);
+	if (mmtrace_pid) {
+		if (!mmtrace_alive(mmtrace_pid) || !mmtrace_alive(mmtrace_tracer)) {
+			pr_info("mm_trace: the %s has exited; tracing stopped\n",
+				mmtrace_alive(mmtrace_pid) ? "tracer" : "traced process");
+			mmtrace_stop();
+		} else
+			schedule_delayed_work(&mmtrace_reaper, HZ);
+	}
+	mutex_unlock(&mmtrace_lock);
+}
+
+static int mmtrace_start(pid_t nr)
+{
+	struct task_struct *task;
+	struct mm_struct *mm;
+	struct pid *pid;
+	int cpu, i, nreg = 0;
+
+	pid = find_get_pid(nr);
+	if (!pid)
+		return -ESRCH;
+	task = get_pid_task(pid, PIDTYPE_PID);
+	put_pid(pid);
+	if (!task)
+		return -ESRCH;
+	mm = get_task_mm(task);
+	if (!mm) {		/* a kernel thread */
+		put_task_struct(task);
+		return -EINVAL;
+	}
+	mmtrace_stop();
+	mmput(mm);
+	mmtrace_seen_missed = 0;
+
+	if (!mmtrace_rings) {
+		mmtrace_ring_sz = PAGE_ALIGN(max(mmtrace_ring_kb, 8U) * 1024);
+		mmtrace_nrec = rounddown_pow_of_two((mmtrace_ring_sz - PAGE_SIZE) /
+						    sizeof(struct procmap_mm_event));
+		mmtrace_rings = vmalloc_user(nr_cpu_ids * mmtrace_ring_sz);
+		mmtrace_seen_drops = kcalloc(nr_cpu_ids, sizeof(u32), GFP_KERNEL);
+		if (!mmtrace_rings || !mmtrace_seen_drops) {
+			vfree(mmtrace_rings);
+			kfree(mmtrace_seen_drops);
+			mmtrace_rings = NULL;
+			mmtrace_seen_drops = NULL;
+			put_task_struct(task);
+			return -ENOMEM;
+		}
+	}
+	for_each_possible_cpu(cpu) {
+		struct procmap_ring_hdr *h = mmring_hdr(cpu);
+
+		*h = (struct procmap_ring_hdr) {
+			.magic = PROCMAP_MMEV_MAGIC,
+			.version = PROCMAP_MMEV_VERSION,
+			.nrec = mmtrace_nrec,
+			.rec_size = sizeof(struct procmap_mm_event),
+			.cpu = cpu,
+		};
+		mmtrace_seen_drops[cpu] = 0;
+	}
+	mmtrace_tracer = get_pid(task_tgid(current));
+	WRITE_ONCE(mmtrace_pid, get_pid(task_tgid(task)));
+	put_task_struct(task);
+
+	for (i = 0; i < ARRAY_SIZE(mmprobes); i++) {
+		struct kretprobe *rp = &mmprobes[i].rp;
+		int ret;
+
+		/* (re)initialize it; a kretprobe can't be registered as left by unregister */
+		memset(rp, 0, sizeof(*rp));
+		rp->kp.symbol_name = mmprobes[i].call;
+		rp->entry_handler = mmprobe_entry;
+		rp->handler = mmprobe_ret;
+		rp->data_size = sizeof(struct mmprobe_data);
+		/* every process's calls take an instance, if only briefly: be generous */
+		rp->maxactive = max_t(int, 8 * num_possible_cpus(), 64);
+		ret = register_kretprobe(rp);
+		if (ret) {
+			pr_info("mm_trace: can't probe %s (%d); it's events won't be seen\n",
+				mmprobes[i].call, ret);
+			continue;
+		}
+		mmprobes[i].registered = true;
+		nreg++;
+	}
+	if (!nreg) {
+		mmtrace_stop();
+		return -ENOENT;
+	}
+	mod_delayed_work(system_wq, &mmtrace_reaper, HZ);
+	return 0;
+}
+
+/* Our debugfs file 6 write callback: the PID to trace, 0 to stop */
+static ssize_t dbgfs_mmtrace_write(struct file *filp, const char __user *ubuf,
+				   size_t count, loff_t *fpos)
+{
+	int pid, ret;
+
+	ret = kstrtoint_from_user(ubuf, count, 10, &pid);
+	if (ret)
+		return ret;
+	if (pid < 0)
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&mmtrace_lock))
 		return -ERESTARTSYS;
+	if (pid)
+		ret = mmtrace_start(pid);
+	else
+		mmtrace_stop();
+	mutex_unlock(&mmtrace_lock);
+
+	return ret ? ret : count;
+}
+
+/* Max length of one line of the mm_trace report */
+#define MMTRACE_LINELEN		160
+
+/* Our debugfs file 6 read callback: drain the rings (as text) */
+static ssize_t dbgfs_mmtrace_read(struct file *filp, char __user *ubuf,
+				  size_t count, loff_t *fpos)
+{
+	size_t sz = min_t(size_t, count, 64 * 1024), len = 0;
+	unsigned long missed;
+	ssize_t ret = 0;
+	char *buf;
+	int cpu, i;
 
-	kbuf = kzalloc(MAXLEN, GFP_KERNEL);
-	if (unlikely(!kbuf)) {
-		mutex_unlock(&mtx);
+	if (sz < MMTRACE_LINELEN)
+		return -EINVAL;
+	buf = kmalloc(sz, GFP_KERNEL);
+	if (!buf)
 		return -ENOMEM;
+	if (mutex_lock_interruptible(&mmtrace_lock)) {
+		kfree(buf);
+		return -ERESTARTSYS;
+	}
+	if (!mmtrace_rings)
+		goto out_unlock;
+
+	missed = 0;
+	for (i = 0; i < ARRAY_SIZE(mmprobes); i++)
+		if (mmprobes[i].registered)
+			missed += mmprobes[i].rp.nmissed;
+	if (missed > mmtrace_seen_missed) {
+		len += scnprintf(buf + len, sz - len, "# missed %lu\n", missed - mmtrace_seen_missed);
+		mmtrace_seen_missed = missed;
+	}
+	for_each_possible_cpu(cpu) {
+		struct procmap_ring_hdr *h = mmring_hdr(cpu);
+		u32 head = smp_load_acquire(&h->head), tail = READ_ONCE(h->tail);
+		u32 dropped = READ_ONCE(h->dropped);
+
+		if (dropped != mmtrace_seen_drops[cpu]) {
+			len += scnprintf(buf + len, sz - len, "# dropped %u\n",
+					 dropped - mmtrace_seen_drops[cpu]);
+			mmtrace_seen_drops[cpu] = dropped;
+		}
+		if (head - tail > mmtrace_nrec)	/* (a confused mmap consumer) */
+			tail = head - mmtrace_nrec;
+		for (; tail != head && sz - len >= MMTRACE_LINELEN; tail++) {
+			const struct procmap_mm_event *ev = mmring_rec(cpu, tail);
+
+			len += scnprintf(buf + len, sz - len,
+					 "%llu %u %u %s %llx %llu %llx %llu %llx\n",
+					 ev->ts, ev->cpu, ev->tid,
+					 ev->type < ARRAY_SIZE(mmev_names) && mmev_names[ev->type] ?
+					 mmev_names[ev->type] : "?",
+					 ev->addr, ev->len, ev->addr2, ev->len2, ev->caller);
+		}
+		smp_store_release(&h->tail, tail);
+		if (sz - len < MMTRACE_LINELEN)
+			break;
 	}
+	ret = len;
+	if (len && copy_to_user(ubuf, buf, len))
+		ret = -EFAULT;
 
-	query_kernelseg_details(kbuf);
+ out_unlock:
+	mutex_unlock(&mmtrace_lock);
+	kfree(buf);
+	return ret;
+}
 
-	ret = simple_read_from_buffer(ubuf, MAXLEN, fpos, kbuf, strlen(kbuf));
-	//MSG("ret = %ld\n", ret);
-	kfree(kbuf);
-	mutex_unlock(&mtx);
+/* Our debugfs file 6 mmap callback: map the rings (for a consumer that drains them itself) */
+static int dbgfs_mmtrace_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	int ret = -ENODATA;
 
+	if (mutex_lock_interruptible(&mmtrace_lock))
+		return -ERESTARTSYS;
+	if (mmtrace_rings) {	/* (allocated on the first start) */
+		ret = -EINVAL;
+		if (!vma->vm_pgoff && vma->vm_end - vma->vm_start <= nr_cpu_ids * mmtrace_ring_sz)
+			ret = remap_vmalloc_range(vma, mmtrace_rings, 0);
+	}
+	mutex_unlock(&mmtrace_lock);
 	return ret;
 }
 
-static const struct file_operations dbgfs_fops = {
-	.read = dbgfs_show_kernelseg,
+static const struct file_operations dbgfs_mmtrace_fops = {
+	.owner = THIS_MODULE,
+	.write = dbgfs_mmtrace_write,
+	.read = dbgfs_mmtrace_read,
+	.mmap = dbgfs_mmtrace_mmap,
+	.llseek = noop_llseek,
+};
+
+static void mmtrace_cleanup(void)
+{
+	mutex_lock(&mmtrace_lock);
+	mmtrace_stop();
+	vfree(mmtrace_rings);
+	kfree(mmtrace_seen_drops);
+	mmtrace_rings = NULL;
+	mutex_unlock(&mmtrace_lock);
+	/* (not tracing now, so it won't rearm itself) */
+	cancel_delayed_work_sync(&mmtrace_reaper);
+}
+#endif				/* CONFIG_KRETPROBES */
+
+static int dbgfs_vma_open(struct inode *inode, struct file *filp)
+{
+	struct vma_walk_ctx *ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+
+	if (!ctx)
+		return -ENOMEM;
+	mutex_init(&ctx->lock);
+	ctx->gen = (pid_report_fn)inode->i_private;
+	filp->private_data = ctx;
+	return 0;
+}
+
+static int dbgfs_vma_release(struct inode *inode, struct file *filp)
+{
+	struct vma_walk_ctx *ctx = filp->private_data;
+
+	kvfree(ctx->img);
+	kfree(ctx);
+	return 0;
+}
+
+/* Our debugfs files 2, 3 and 5 write callback: the PID to report upon */
+static ssize_t dbgfs_vma_write(struct file *filp, const char __user *ubuf,
+			       size_t count, loff_t *fpos)
+{
+	struct vma_walk_ctx *ctx = filp->private_data;
+	int pid, ret;
+
+	ret = kstrtoint_from_user(ubuf, count, 10, &pid);
+	if (ret)
+		return ret;
+	if (pid <= 0)
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&ctx->lock))
+		return -ERESTARTSYS;
+	kvfree(ctx->img);
+	ctx->img = NULL;
+	ctx->len = 0;
+	ret = ctx->gen(pid, &ctx->img, &ctx->len);
+	/* a new report: it's read from the start (on this same fd) */
+	if (!ret)
+		*fpos = 0;
+	mutex_unlock(&ctx->lock);
+
+	return ret ? ret : count;
+}
+
+/* Our debugfs files 2, 3 and 5 read callback: the report */
+static ssize_t dbgfs_vma_read(struct file *filp, char __user *ubuf,
+			      size_t count, loff_t *fpos)
+{
+	struct vma_walk_ctx *ctx = filp->private_data;
+	ssize_t ret;
+
+	if (mutex_lock_interruptible(&ctx->lock))
+		return -ERESTARTSYS;
+	if (!ctx->img)		/* no PID written yet */
+		ret = -ENODATA;
+	else
+		ret = simple_read_from_buffer(ubuf, count, fpos, ctx->img, ctx->len);
+	mutex_unlock(&ctx->lock);
+
+	return ret;
+}
+
+static const struct file_operations dbgfs_vma_fops = {
+	.owner = THIS_MODULE,
+	.open = dbgfs_vma_open,
+	.release = dbgfs_vma_release,
+	.write = dbgfs_vma_write,
+	.read = dbgfs_vma_read,
+	.llseek = default_llseek,
 };
 
 static int setup_debugfs_file(void)
 {
-	struct dentry *file1;
+	struct dentry *file1, *file2, *file3, *file4 __maybe_unused, *file5;
+	struct dentry *file6 __maybe_unused;
 	int stat = 0;
 
 	if (!IS_ENABLED(CONFIG_DEBUG_FS)) {
@@ -305,6 +1749,72 @@ static int setup_debugfs_file(void)
 	pr_debug("debugfs file 1 <debugfs_mountpt>/%s/%s created\n",
 		 KBUILD_MODNAME, DBGFS_FILE1);
 
+	/* Create the per-PID VMA walk debugfs file; root-only, it can read any process */
+#define DBGFS_FILE2	"vma_walk"
+	file2 = debugfs_create_file(DBGFS_FILE2, 0600, gparent, (void *)vma_walk_pid,
+				    &dbgfs_vma_fops);
+	if (!file2) {
+		pr_info("debugfs_create_file failed, aborting...\n");
+		stat = PTR_ERR(file2);
+		goto out_fail_2;
+	}
+	pr_debug("debugfs file 2 <debugfs_mountpt>/%s/%s created\n",
+		 KBUILD_MODNAME, DBGFS_FILE2);
+
+	/* Create the per-PID page-table walk debugfs file; root-only as well */
+#define DBGFS_FILE3	"pgtable_walk"
+	file3 = debugfs_create_file(DBGFS_FILE3, 0600, gparent, (void *)pt_walk_pid,
+				    &dbgfs_vma_fops);
+	if (!file3) {
+		pr_info("debugfs_create_file failed, aborting...\n");
+		stat = PTR_ERR(file3);
+		goto out_fail_2;
+	}
+	pr_debug("debugfs file 3 <debugfs_mountpt>/%s/%s created\n",
+		 KBUILD_MODNAME, DBGFS_FILE3);
+
+	/* Create the per-PID accessed-bit walk debugfs file; root-only as well */
+#define DBGFS_FILE5	"accessed_walk"
+	file5 = debugfs_create_file(DBGFS_FILE5, 0600, gparent, (void *)young_walk_pid,
+				    &dbgfs_vma_fops);
+	if (!file5) {
+		pr_info("debugfs_create_file failed, aborting...\n");
+		stat = PTR_ERR(file5);
+		goto out_fail_2;
+	}
+	pr_debug("debugfs file 5 <debugfs_mountpt>/%s/%s created\n",
+		 KBUILD_MODNAME, DBGFS_FILE5);
+
+#ifdef PROCMAP_HAVE_MMTRACE
+	/* Create the mm event tracing debugfs file; root-only as well */
+#define DBGFS_FILE6	"mm_trace"
+	file6 = debugfs_create_file(DBGFS_FILE6, 0600, gparent, NULL, &dbgfs_mmtrace_fops);
+	if (!file6) {
+		pr_info("debugfs_create_file failed, aborting...\n");
+		stat = PTR_ERR(file6);
+		goto out_fail_2;
+	}
+	pr_debug("debugfs file 6 <debugfs_mountpt>/%s/%s created\n",
+		 KBUILD_MODNAME, DBGFS_FILE6);
+#else
+	pr_info("mm event tracing unsupported here (needs kretprobes, and a 5.3 or later kernel)\n");
+#endif
+
+#ifdef procmap_kpgd_offset
+	/* Create the kernel region occupancy debugfs file; root-only as well */
+#define DBGFS_FILE4	"kseg_occupancy"
+	file4 = debugfs_create_file(DBGFS_FILE4, 0400, gparent, NULL, &dbgfs_kocc_fops);
+	if (!file4) {
+		pr_info("debugfs_create_file failed, aborting...\n");
+		stat = PTR_ERR(file4);
+		goto out_fail_2;
+	}
+	pr_debug("debugfs file 4 <debugfs_mountpt>/%s/%s created\n",
+		 KBUILD_MODNAME, DBGFS_FILE4);
+#else
+	pr_info("kernel region occupancy unsupported here (init_mm isn't exported)\n");
+#endif
+
 	return 0;		/* success */
 
  out_fail_2:
@@ -323,13 +1833,24 @@ static int __init procmap_init(void)
 		pr_info("fyi, RHEL release = %d\n", effective_rhel_release_code());
 	}
 
+	ret = kseg_layout_init();
+	if (ret) {
+		kfree(kseg_layout);
+		return ret;
+	}
 	ret = setup_debugfs_file();
+	if (ret)
+		kfree(kseg_layout);
 	return ret;
 }
 
 static void __exit procmap_exit(void)
 {
 	debugfs_remove_recursive(gparent);
+#ifdef PROCMAP_HAVE_MMTRACE
+	mmtrace_cleanup();
+#endif
+	kfree(kseg_layout);
 	pr_info("removed\n");
 }
 
@@ -0,0 +1,206 @@
+#!/bin/bash
+# benchmark.sh
+# Part of the procmap project.
+#
+# Benchmark / performance regression suite: runs procmap upon test processes
+# with large, synthetic, address spaces - 1k, 10k, 100k and 1M mappings (as
+# far as vm.max_map_count allows) - timing each phase end to end (via
+# procmap's TIMING_FILE hook): mapsfile_prep.sh, building the user segment
+# table (parse + sort), the kernel segment, graphit and the stats.
+# The results are written (CSV) to the results file and compared against the
+# stored baseline; a phase that's slower than the baseline by more than the
+# threshold fails the run.
+#
+# Usage: benchmark.sh [--save-baseline]
+#  --save-baseline : (re)write the baseline from this run's results
+# Environment (all optional):
+#  BENCH_SIZES       : # of mappings of the test processes [1000 10000 100000 1000000]
+#  BENCH_REPS        : runs per size; the fastest one's kept [3]
+#  BENCH_TIMEOUT     : max seconds per procmap run [600]
+#  BENCH_THRESHOLD   : % slowdown (vs the baseline) that fails a phase [20]
+#  BENCH_SLACK_MS    : absolute slack, so that tiny phases don't fail on noise [50]
+#  BENCH_PROCMAP_OPTS: extra options passed to procmap [--only-user]
+#  BENCH_RESULTS     : the results file [./bench_results.csv]
+#  BENCH_BASELINE    : the baseline file [./bench_baseline.csv]
+# Exit status: 0 = pass (or no baseline yet), 1 = regression(s), 2 = error
+PROCMAP=../procmap
+MAPGEN=/tmp/procmap_mapgen
+
+SIZES=${BENCH_SIZES:-1000 10000 100000 1000000}
+REPS=${BENCH_REPS:-3}
+TMOUT=${BENCH_TIMEOUT:-600}
+THRESHOLD=${BENCH_THRESHOLD:-20}
+SLACK_MS=${BENCH_SLACK_MS:-50}
+PROCMAP_OPTS=${BENCH_PROCMAP_OPTS:---only-user}
+RESULTS=${BENCH_RESULTS:-./bench_results.csv}
+BASELINE=${BENCH_BASELINE:-./bench_baseline.csv}
+
+die()
+{
+echo >&2 "FATAL: $*"
+exit 2
+}
+
+# The test process: creates (about) N mappings and waits; every 8th one's a
+# mapping of a (shared) data file, the rest are anonymous. Neighbouring
+# mappings get different protections (or file offsets), so that the kernel
+# can't merge them into one VMA.
+gen_mapgen()
+{
+cat > ${MAPGEN}.c << @EOF@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+int main(int argc, char **argv)
+{
+	long i, n = (argc > 1) ? atol(argv[1]) : 1000;
+	long pgsz = sysconf(_SC_PAGESIZE);
+	char *base;
+	int fd = open("${MAPGEN}.dat", O_RDWR|O_CREAT, 0600);
+
+	if (fd < 0 || ftruncate(fd, 64*pgsz) < 0) {
+		perror("mapgen: data file");
+		return 1;
+	}
+	/* reserve the range in one go; then carve it up */
+	base = mmap(NULL, n*pgsz, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) {
+		perror("mapgen: mmap");
+		return 1;
+	}
+	for (i = 0; i < n; i++) {
+		if (i % 8 == 7) {
+			if (mmap(base + i*pgsz, pgsz, PROT_READ, MAP_SHARED|MAP_FIXED, fd,
+				 (i % 64)*pgsz) == MAP_FAILED)
+				break;
+		} else if (i % 2) {
+			if (mprotect(base + i*pgsz, pgsz, PROT_READ|PROT_WRITE) < 0)
+				break;
+			base[i*pgsz] = 1;
+		}
+	}
+	if (i < n)
+		fprintf(stderr, "mapgen: stopped at %ld mappings\n", i);
+	printf("ready\n");
+	fflush(stdout);
+	pause();
+	return 0;
+}
+@EOF@
+gcc -O2 -Wall ${MAPGEN}.c -o ${MAPGEN} || die "couldn't build the test program"
+}
+
+# Run procmap once upon PID; append the phase timings (ms) to ${RESULTS}
+# Parameters:
+#   $1 = # of mappings (the 'size')
+#   $2 = PID
+bench_one()
+{
+local sz=$1 pid=$2 tfile=/tmp/procmap_bench.timing t0 t1 best_total=0 rep
+local -A best
+
+for rep in $(seq ${REPS}) ; do
+   rm -f ${tfile}
+   t0=${EPOCHREALTIME/./}
+   TIMING_FILE=${tfile} timeout ${TMOUT} ${PROCMAP} -p ${pid} ${PROCMAP_OPTS} >/dev/null 2>&1
+   local ret=$?
+   t1=${EPOCHREALTIME/./}
+   [ ${ret} -eq 124 ] && {
+      echo "  (run ${rep}: timed out after ${TMOUT}s)"
+      echo "${sz},total,timeout" >> ${RESULTS}
+      return
+   }
+   # an incomplete run (no timing for the last phase) doesn't count
+   grep -q "^stats," ${tfile} 2>/dev/null || {
+      echo "  (run ${rep}: procmap failed)"
+      continue
+   }
+   local total=$(((t1-t0)/1000))
+   [[ ${best_total} -eq 0 || ${total} -lt ${best_total} ]] && {
+      best_total=${total}
+      best=()
+      # the timing file has absolute (usec) timestamps; take the differences
+      local phase ms
+      while IFS=" " read -r phase ms ; do
+         best[${phase}]=$(((${best[${phase}]:-0}) + ms))
+      done < <(awk -F, 'NR > 1 { printf("%s %d\n", $1, ($2 - pt)/1000) } { pt = $2 }' ${tfile})
+   }
+done
+[ ${best_total} -eq 0 ] && {
+   echo "${sz},total,error" >> ${RESULTS}
+   return
+}
+local phase
+for phase in "${!best[@]}" ; do
+   echo "${sz},${phase},${best[${phase}]}" >> ${RESULTS}
+done
+echo "${sz},total,${best_total}" >> ${RESULTS}
+printf "  total %6d ms\n" ${best_total}
+}
+
+# Compare ${RESULTS} with ${BASELINE}; returns 1 if any phase regressed
+compare_baseline()
+{
+awk -F, -v th=${THRESHOLD} -v slack=${SLACK_MS} '
+/^#/ { next }
+FNR == NR { base[$1 "," $2] = $3 ; next }
+{
+  k = $1 "," $2
+  if (!(k in base)) { printf("%-28s %10s %10s  (new)\n", k, "-", $3) ; next }
+  b = base[k] ; verdict = "ok"
+  if ($3 == "error")
+    verdict = "FAIL"
+  else if ($3 == "timeout")
+    verdict = (b == "timeout") ? "ok" : "FAIL"
+  else if (b ~ /^[0-9]+$/ && $3 > b * (1 + th/100) + slack)
+    verdict = "FAIL"
+  if (verdict == "FAIL") nfail++
+  printf("%-28s %10s %10s  %s\n", k, b, $3, verdict)
+}
+END {
+  printf("\n%d regression(s) (threshold: +%d%% + %d ms)\n", nfail, th, slack)
+  exit (nfail > 0)
+}' ${BASELINE} ${RESULTS}
+}
+
+
+#--- 'main'
+[[ ! -x ${PROCMAP} ]] && die "procmap script not located correctly? (value = ${PROCMAP})"
+[ "${EPOCHREALTIME:-}" = "" ] && die "need bash 5 or later (for EPOCHREALTIME)"
+gen_mapgen
+
+MAXMAP=$(cat /proc/sys/vm/max_map_count)
+echo "# size,phase,ms" > ${RESULTS}
+for sz in ${SIZES} ; do
+   # leave headroom for the process's 'usual' mappings
+   if [ ${sz} -gt $((MAXMAP-1000)) ] ; then
+      echo "[size ${sz}] skipped: above vm.max_map_count (${MAXMAP})"
+      continue
+   fi
+   echo "[size ${sz}]"
+   coproc MG { exec ${MAPGEN} ${sz} ; }
+   # don't leave it (nor its data file) behind if we die or are interrupted
+   trap 'kill ${MG_PID} 2>/dev/null ; rm -f ${MAPGEN}.dat' EXIT
+   trap 'exit 2' INT TERM
+   read -r -u ${MG[0]} || die "test program failed to start"
+   bench_one ${sz} ${MG_PID}
+   kill ${MG_PID} ; wait ${MG_PID} 2>/dev/null
+done
+trap - EXIT INT TERM
+rm -f ${MAPGEN}.dat log_procmap.txt  # (procmap appends to the log on each run)
+echo "[i] results written to ${RESULTS}"
+
+if [ "$1" = "--save-baseline" ] ; then
+   cp ${RESULTS} ${BASELINE}
+   echo "[i] baseline saved to ${BASELINE}"
+   exit 0
+fi
+[ ! -f ${BASELINE} ] && {
+   echo "[!] no baseline (${BASELINE}) to compare with; run with --save-baseline to create it"
+   exit 0
+}
+echo
+printf "%-28s %10s %10s\n" "size,phase" "base(ms)" "now(ms)"
+compare_baseline